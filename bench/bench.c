@@ -0,0 +1,524 @@
+/* SDL2, for the performance counter */
+#include <SDL2/SDL.h>
+
+/* C Stdlib Headers */
+#include <math.h>   /* sin(), cos(), sqrt(), INFINITY */
+#include <stdbool.h>/* For boolean type */
+#include <stdio.h>  /* Console I/O */
+#include <stdlib.h> /* malloc(), realloc(), free(), qsort(), exit() */
+#include <string.h> /* strcmp() */
+
+/* Project headers */
+#include "math3d.h"   /* Vector and matrix math */
+#include "mesh.h"     /* Indexed meshes */
+#include "pipeline.h" /* Geometry pipeline */
+#include "profiler.h" /* Per frame counters */
+#include "raster.h"   /* Render targets */
+#include "scene.h"    /* Scene hierarchy and frustum culling */
+#include "texture.h"  /* Mipmapped textures */
+#include "tiles.h"    /* Tiled, multi-threaded rasterization */
+
+/* Consts */
+#define WARMUP_FRAMES 10 /* Untimed frames before each measurement */
+#define TIMED_FRAMES  50 /* Timed frames per measurement */
+#define FOV           60.0f
+#define NEAR_Z        0.1f
+#define FAR_Z         999.0f
+#define CHECKER_SIZE  256 /* Texels across the texture of textured scenes */
+#define CHECKER_CELLS 8   /* Squares across it */
+#define HIDDEN_COL    ((col_t){0xff, 0x00, 0x00, 0xff}) /* Of hiding meshes */
+
+/*
+ * Benchmark suite: renders fixed synthetic scenes at fixed resolutions and
+ * prints one CSV row per scene and resolution, so runs on two commits can
+ * be diffed. Scenes are static, so every frame of a run draws the same
+ * pixels. Scenes whose result is known are checked too, and the suite
+ * exits with an error if one is drawn wrong.
+ */
+
+/* A mesh being built, with room to grow */
+typedef struct {
+  mesh_t mesh;
+  u32 vert_capacity, tri_capacity;
+  bool textured; /* Give vertices texture coordinates */
+} builder_t;
+
+/* A benchmark scene: a mesh, drawn as copies instances laid out on a grid */
+typedef struct {
+  const char *name;
+  void (*build)(builder_t *builder);
+  u32 copies;
+  bool hidden; /* Every pixel must end up HIDDEN_COL */
+} bench_scene_t;
+
+/* Resolutions every scene is run at */
+static const struct {
+  i32 width, height;
+} resolutions[] = {
+    {320, 180},
+    {640, 360},
+    {1280, 720},
+    {1920, 1080},
+};
+
+/* Grow a stream of a mesh being built, exiting if out of memory */
+static void *grow(void *stream, u64 size) {
+  void *grown = realloc(stream, size);
+  if (!grown) {
+    fprintf(stderr, "ERROR: Out of memory building a scene\n");
+    exit(1);
+  }
+  return grown;
+}
+/* Add a vertex to a mesh, returns its index */
+static u32 add_vert(builder_t *builder, vec3_t pos, col_t col) {
+  mesh_t *mesh = &builder->mesh;
+  if (mesh->vert_count == builder->vert_capacity) {
+    builder->vert_capacity = MAX(builder->vert_capacity * 2, 256);
+    mesh->x = grow(mesh->x, sizeof(f32) * builder->vert_capacity);
+    mesh->y = grow(mesh->y, sizeof(f32) * builder->vert_capacity);
+    mesh->z = grow(mesh->z, sizeof(f32) * builder->vert_capacity);
+    mesh->cols = grow(mesh->cols, sizeof(col_t) * builder->vert_capacity);
+    if (builder->textured) {
+      mesh->u = grow(mesh->u, sizeof(f32) * builder->vert_capacity);
+      mesh->v = grow(mesh->v, sizeof(f32) * builder->vert_capacity);
+    }
+  }
+  mesh->x[mesh->vert_count] = pos.x;
+  mesh->y[mesh->vert_count] = pos.y;
+  mesh->z[mesh->vert_count] = pos.z;
+  mesh->cols[mesh->vert_count] = col;
+  return mesh->vert_count++;
+}
+/* Add a triangle to a mesh */
+static void add_tri(builder_t *builder, u32 a, u32 b, u32 c) {
+  mesh_t *mesh = &builder->mesh;
+  if (mesh->tri_count == builder->tri_capacity) {
+    builder->tri_capacity = MAX(builder->tri_capacity * 2, 256);
+    mesh->indices =
+        grow(mesh->indices, sizeof(u32) * 3 * builder->tri_capacity);
+  }
+  u32 *corners = mesh->indices + (3 * mesh->tri_count++);
+  corners[0] = a;
+  corners[1] = b;
+  corners[2] = c;
+}
+/* Add a quad facing the camera (-z) as two triangles */
+static void add_quad(builder_t *builder, u32 bottom_left, u32 top_left,
+                     u32 bottom_right, u32 top_right) {
+  add_tri(builder, bottom_left, top_left, bottom_right);
+  add_tri(builder, bottom_right, top_left, top_right);
+}
+/* Get a colour that varies smoothly with a pair of parameters */
+static col_t ramp(f32 u, f32 v) {
+  return (col_t){(u8)(255 * u), (u8)(255 * v), (u8)(255 * (1 - u)), 0xff};
+}
+/* Add a grid of quads facing the camera, from (x0, y0) to (x1, y1) */
+static void add_grid(builder_t *builder, f32 x0, f32 y0, f32 x1, f32 y1,
+                     f32 z, u32 cells_x, u32 cells_y) {
+  u32 first = builder->mesh.vert_count;
+  for (u32 j = 0; j <= cells_y; j++) {
+    for (u32 i = 0; i <= cells_x; i++) {
+      f32 u = (f32)i / cells_x, v = (f32)j / cells_y;
+      add_vert(builder,
+               (vec3_t){x0 + (x1 - x0) * u, y0 + (y1 - y0) * v, z},
+               ramp(u, v));
+    }
+  }
+  for (u32 j = 0; j < cells_y; j++) {
+    for (u32 i = 0; i < cells_x; i++) {
+      u32 corner = first + (j * (cells_x + 1)) + i;
+      add_quad(builder, corner, corner + cells_x + 1,
+               corner + 1, corner + cells_x + 2);
+    }
+  }
+}
+
+/* Many triangles a few pixels across, covering the view */
+static void build_tiny(builder_t *builder) {
+  add_grid(builder, -2.0f, -1.2f, 2.0f, 1.2f, 2.0f, 320, 180);
+}
+/* A few triangles that each cover the whole view */
+static void build_large(builder_t *builder) {
+  for (u32 i = 0; i < 4; i++) {
+    add_grid(builder, -20.0f, -20.0f, 20.0f, 20.0f, 2.0f + i, 1, 1);
+  }
+}
+/*
+ * Many tiny triangles covering the view, drawn first, hiding as many just
+ * behind them. Depth interpolated a little short on any of them shows
+ * through, and none covers a whole coarse depth block, so every pixel is
+ * depth tested.
+ */
+static void build_hidden(builder_t *builder) {
+  add_grid(builder, -2.0f, -1.2f, 2.0f, 1.2f, 1.9f, 320, 180);
+  for (u32 i = 0; i < builder->mesh.vert_count; i++) {
+    builder->mesh.cols[i] = HIDDEN_COL;
+  }
+  add_grid(builder, -2.0f, -1.2f, 2.0f, 1.2f, 2.1f, 320, 180);
+}
+/* Screen filling layers drawn back to front, every one passing depth */
+static void build_overdraw(builder_t *builder) {
+  for (u32 i = 0; i < 16; i++) {
+    add_grid(builder, -20.0f, -20.0f, 20.0f, 20.0f, 17.0f - i, 1, 1);
+  }
+}
+/* Add a UV sphere */
+static void add_sphere(builder_t *builder, vec3_t centre, f32 radius,
+                       u32 stacks, u32 slices) {
+  u32 first = builder->mesh.vert_count;
+  for (u32 j = 0; j <= stacks; j++) {
+    f32 v = (f32)j / stacks;
+    f32 theta = v * PI;
+    for (u32 i = 0; i <= slices; i++) {
+      f32 u = (f32)i / slices;
+      f32 phi = u * TWO_PI;
+      vec3_t pos = {
+          centre.x + radius * sinf(theta) * cosf(phi),
+          centre.y - radius * cosf(theta),
+          centre.z + radius * sinf(theta) * sinf(phi),
+      };
+      add_vert(builder, pos, ramp(u, v));
+    }
+  }
+  for (u32 j = 0; j < stacks; j++) {
+    for (u32 i = 0; i < slices; i++) {
+      u32 corner = first + (j * (slices + 1)) + i;
+      add_quad(builder, corner, corner + slices + 1,
+               corner + 1, corner + slices + 2);
+    }
+  }
+}
+/* A finely tessellated sphere in the middle of the view */
+static void build_sphere(builder_t *builder) {
+  add_sphere(builder, (vec3_t){0.0f, 0.0f, 3.0f}, 1.0f, 200, 250);
+}
+/* A small sphere, copied all around the camera so most copies are culled */
+static void build_crowd(builder_t *builder) {
+  add_sphere(builder, (vec3_t){0.0f, 0.0f, 0.0f}, 0.5f, 12, 16);
+}
+/*
+ * Add a floor running from behind the camera into the distance, with the
+ * texture repeating across it if the mesh is textured
+ */
+static void add_floor(builder_t *builder) {
+  const u32 cells = 64;
+  u32 first = builder->mesh.vert_count;
+  for (u32 j = 0; j <= cells; j++) {
+    for (u32 i = 0; i <= cells; i++) {
+      f32 u = (f32)i / cells, v = (f32)j / cells;
+      vec3_t pos = {-20.0f + 40.0f * u, -1.0f, -10.0f + 60.0f * v};
+      u32 vert = add_vert(builder, pos, ramp(u, v));
+      if (builder->textured) {
+        builder->mesh.u[vert] = 20.0f * u;
+        builder->mesh.v[vert] = 30.0f * v;
+      }
+    }
+  }
+  for (u32 j = 0; j < cells; j++) {
+    for (u32 i = 0; i < cells; i++) {
+      u32 corner = first + (j * (cells + 1)) + i;
+      add_quad(builder, corner, corner + cells + 1,
+               corner + 1, corner + cells + 2);
+    }
+  }
+}
+/* A floor running from behind the camera into the distance */
+static void build_near_plane(builder_t *builder) {
+  add_floor(builder);
+}
+/* The same floor, textured, minified more and more into the distance */
+static void build_textured(builder_t *builder) {
+  builder->textured = true;
+  add_floor(builder);
+}
+
+/* The scenes, in the order they are run */
+static const bench_scene_t scenes[] = {
+    {"tiny", build_tiny, 1, false},
+    {"large", build_large, 1, false},
+    {"overdraw", build_overdraw, 1, false},
+    {"sphere", build_sphere, 1, false},
+    {"near_plane", build_near_plane, 1, false},
+    {"textured", build_textured, 1, false},
+    {"crowd", build_crowd, 64 * 64, false},
+    {"hidden", build_hidden, 1, true},
+};
+
+/*
+ * Render one frame of a scene, clearing the whole target first if eager,
+ * or each tile as it is filled otherwise
+ */
+static void render(const target_t *target, mat4_t view_proj,
+                   scene_t *scene, bool eager_clear) {
+  col_t clear_col = {0x00, 0x00, 0x00, 0xff};
+  if (eager_clear)
+    cleartarget(target, clear_col);
+  pipeline_begin(target, view_proj);
+  if (!eager_clear)
+    pipeline_clear(clear_col);
+  scene_draw(scene, view_proj);
+  pipeline_end();
+}
+/* Render one profiled frame of a scene, returning the pixels it shaded */
+static u64 count_shaded(const target_t *target, mat4_t view_proj,
+                        scene_t *scene, bool eager_clear) {
+  profiler_init(NULL);
+  profiler_frame_begin();
+  render(target, view_proj, scene, eager_clear);
+  profiler_frame_end((u64)target->width * target->height);
+  u64 shaded = profiler_frame_counter(PROF_PIXELS_SHADED);
+  profiler_quit();
+  return shaded;
+}
+/*
+ * Count the pixels of a target that aren't a colour, allowing each channel
+ * to be one less for interpolation rounding down
+ */
+static u64 count_other(const target_t *target, col_t col) {
+  u32 pixel = PACK_COL(col);
+  u64 count = 0;
+  for (u64 i = 0; i < (u64)target->width * target->height; i++) {
+    for (u32 shift = 8; shift < 32; shift += 8) {
+      i32 diff = (i32)((pixel >> shift) & 0xff)
+               - (i32)((target->color[i] >> shift) & 0xff);
+      if (diff < 0 || diff > 1) {
+        count++;
+        break;
+      }
+    }
+  }
+  return count;
+}
+/* Compare two f64s, for qsort() */
+static int compare_f64(const void *a, const void *b) {
+  f64 x = *(const f64 *)a, y = *(const f64 *)b;
+  return (x > y) - (x < y);
+}
+
+/* Print command line usage */
+static void usage(const char *prog) {
+  printf(
+      "Usage: %s [options]\n"
+      "  --frames N         Timed frames per run (default %d)\n"
+      "  --warmup N         Untimed frames before each run (default %d)\n"
+      "  --scene NAME       Only run one scene: tiny, large, overdraw,\n"
+      "                     sphere, near_plane, textured, crowd or hidden\n"
+      "  --raster KERNEL    Rasterizer kernel: scalar, sse2 or avx2\n"
+      "  --threads N        Threads filling tiles (default: one per CPU)\n"
+      "  --eager-clear      Clear the whole target up front instead of each\n"
+      "                     tile as it is filled\n"
+      "  --deferred         Shade each pixel once, after depth testing,\n"
+      "                     from a visibility buffer\n"
+      "  --sort             Draw objects, and triangles within each tile,\n"
+      "                     front to back\n"
+      "  --depth-prepass    Fill each tile's depth before shading it, and\n"
+      "                     check it shades what --deferred does\n"
+      "  --help             Show this message\n",
+      prog, TIMED_FRAMES, WARMUP_FRAMES
+  );
+}
+
+/* Entry point */
+int main(int argc, char **argv) {
+  /* Parse command line */
+  u32 frames = TIMED_FRAMES, warmup = WARMUP_FRAMES, threads = 0;
+  const char *only_scene = NULL;
+  bool eager_clear = false, deferred = false, sorted = false;
+  bool prepass = false;
+  i32 status = 0;
+  raster_init();
+  for (i32 i = 1; i < argc; i++) {
+    bool has_val = i + 1 < argc;
+    if (strcmp(argv[i], "--frames") == 0 && has_val) {
+      frames = strtoul(argv[++i], NULL, 10);
+      frames = MAX(frames, 1);
+    } else if (strcmp(argv[i], "--warmup") == 0 && has_val) {
+      warmup = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--scene") == 0 && has_val) {
+      only_scene = argv[++i];
+    } else if (strcmp(argv[i], "--raster") == 0 && has_val) {
+      raster_kernel_t kernel = 0;
+      i++;
+      while (kernel < RASTER_COUNT
+             && strcmp(argv[i], raster_kernel_name(kernel)) != 0)
+        kernel++;
+      if (!raster_set_kernel(kernel)) {
+        fprintf(stderr, "ERROR: Rasterizer '%s' is unavailable\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--threads") == 0 && has_val) {
+      threads = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--eager-clear") == 0) {
+      eager_clear = true;
+    } else if (strcmp(argv[i], "--deferred") == 0) {
+      deferred = true;
+    } else if (strcmp(argv[i], "--sort") == 0) {
+      sorted = true;
+    } else if (strcmp(argv[i], "--depth-prepass") == 0) {
+      prepass = true;
+    } else if (strcmp(argv[i], "--help") == 0) {
+      usage(argv[0]);
+      return 0;
+    } else {
+      fprintf(stderr, "ERROR: Unknown or incomplete option '%s'\n", argv[i]);
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  SDL_Init(SDL_INIT_TIMER);
+  if (!tiles_init(threads))
+    fprintf(stderr, "ERROR: Failed to start all tile workers\n");
+  tiles_set_deferred(deferred);
+  tiles_set_sorted(sorted);
+  tiles_set_prepass(prepass);
+  pipeline_set_wireframe(false);
+  f64 freq = (f64)SDL_GetPerformanceFrequency();
+  f64 *times = malloc(sizeof(f64) * frames);
+  if (!times) {
+    fprintf(stderr, "ERROR: Failed to allocate %u frame times\n", frames);
+    return 1;
+  }
+  /* Only meshes with texture coordinates are drawn with it */
+  texture_t checker;
+  if (!texture_checker(&checker, CHECKER_SIZE, CHECKER_CELLS,
+                       (col_t){0xff, 0xff, 0xff, 0xff},
+                       (col_t){0x40, 0x40, 0x40, 0xff})) {
+    fprintf(stderr, "ERROR: Failed to create the checker texture\n");
+    return 1;
+  }
+
+  /* One CSV row per scene and resolution */
+  printf("scene,kernel,threads,width,height,frames,tris,pixels,passes,"
+         "shaded,ms_min,ms_median,ms_avg,mtri_s,mpix_s\n");
+  for (u32 s = 0; s < sizeof(scenes) / sizeof(scenes[0]); s++) {
+    if (only_scene && strcmp(only_scene, scenes[s].name) != 0)
+      continue;
+    builder_t builder = {0};
+    scenes[s].build(&builder);
+    mesh_compute_bounds(&builder.mesh);
+    /* Copies are on a square grid around the camera */
+    u32 copies = scenes[s].copies;
+    u32 side = (u32)ceilf(sqrtf((f32)copies));
+    instance_t *instances = malloc(sizeof(instance_t) * copies);
+    if (!instances) {
+      fprintf(stderr, "ERROR: %s: Failed to allocate %u instances\n",
+              scenes[s].name, copies);
+      return 1;
+    }
+    for (u32 i = 0; i < copies; i++) {
+      vec3_t pos = {0.0f, 0.0f, 0.0f};
+      if (copies > 1) {
+        pos = (vec3_t){
+            3.0f * ((f32)(i % side) - 0.5f * (side - 1)), 0.0f,
+            3.0f * ((f32)(i / side) - 0.5f * (side - 1)),
+        };
+      }
+      instances[i] = (instance_t){
+          .model = translation(pos),
+          .color = {0xff, 0xff, 0xff, 0xff},
+          .texture = &checker,
+      };
+    }
+    scene_t scene = {0};
+    scene.front_to_back = sorted;
+    if (!scene_add(&scene, &builder.mesh, instances, copies)
+        || !scene_build(&scene)) {
+      fprintf(stderr, "ERROR: %s: Failed to build the scene\n",
+              scenes[s].name);
+      return 1;
+    }
+    for (u32 r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++) {
+      i32 width = resolutions[r].width, height = resolutions[r].height;
+      target_t target = {.width = width, .height = height};
+      void *target_memory = alloctarget(
+          &target, (u64)width * height,
+          (u64)HIZ_SIZE(width) * HIZ_SIZE(height)
+      );
+      if (!target_memory) {
+        fprintf(stderr, "ERROR: %s %dx%d: Failed to allocate the target\n",
+                scenes[s].name, width, height);
+        status = 1;
+        continue;
+      }
+      mat4_t view_proj =
+          projection(FOV, (f32)height / width, NEAR_Z, FAR_Z);
+
+      /* Count the work in one profiled frame; every frame is the same */
+      profiler_init(NULL);
+      profiler_frame_begin();
+      render(&target, view_proj, &scene, eager_clear);
+      profiler_frame_end((u64)width * height);
+      u64 tris = profiler_frame_counter(PROF_TRIS_SUBMITTED);
+      u64 pixels = profiler_frame_counter(PROF_PIXELS_TESTED);
+      u64 passes = profiler_frame_counter(PROF_DEPTH_PASSES);
+      u64 shaded = profiler_frame_counter(PROF_PIXELS_SHADED);
+      profiler_quit();
+      if (scenes[s].hidden) {
+        u64 shown = count_other(&target, HIDDEN_COL);
+        if (shown > 0) {
+          fprintf(stderr, "ERROR: %s %dx%d: %llu hidden pixels shown\n",
+                  scenes[s].name, width, height, (unsigned long long)shown);
+          status = 1;
+        }
+      }
+      /* A pre-pass must shade the same front pixels as deferred shading */
+      if (prepass) {
+        tiles_set_prepass(false);
+        tiles_set_deferred(true);
+        u64 expected = count_shaded(&target, view_proj, &scene, eager_clear);
+        tiles_set_deferred(deferred);
+        tiles_set_prepass(prepass);
+        if (shaded != expected) {
+          fprintf(stderr,
+                  "ERROR: %s %dx%d: %llu pixels shaded after the pre-pass, "
+                  "%llu deferred\n",
+                  scenes[s].name, width, height, (unsigned long long)shaded,
+                  (unsigned long long)expected);
+          status = 1;
+        }
+      }
+
+      /* Time it unprofiled */
+      for (u32 i = 0; i < warmup; i++) {
+        render(&target, view_proj, &scene, eager_clear);
+      }
+      f64 total = 0.0;
+      for (u32 i = 0; i < frames; i++) {
+        u64 start = SDL_GetPerformanceCounter();
+        render(&target, view_proj, &scene, eager_clear);
+        u64 end = SDL_GetPerformanceCounter();
+        times[i] = (end - start) / freq * 1000.0;
+        total += times[i];
+      }
+      qsort(times, frames, sizeof(f64), compare_f64);
+      f64 avg = total / frames;
+      printf("%s,%s,%u,%d,%d,%u,%llu,%llu,%llu,%llu,%.4f,%.4f,%.4f,%.2f,"
+             "%.2f\n",
+             scenes[s].name, raster_kernel_name(raster_get_kernel()),
+             tiles_thread_count(), width, height, frames,
+             (unsigned long long)tris, (unsigned long long)pixels,
+             (unsigned long long)passes, (unsigned long long)shaded,
+             times[0], times[frames / 2], avg,
+             tris / avg / 1000.0, pixels / avg / 1000.0);
+      fflush(stdout);
+      free(target_memory);
+    }
+    scene_free(&scene);
+    free(instances);
+    free(builder.mesh.x);
+    free(builder.mesh.y);
+    free(builder.mesh.z);
+    free(builder.mesh.cols);
+    free(builder.mesh.u);
+    free(builder.mesh.v);
+    free(builder.mesh.indices);
+  }
+  free(times);
+  texture_free(&checker);
+  tiles_quit();
+  pipeline_quit();
+  SDL_Quit();
+  return status;
+}
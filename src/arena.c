@@ -0,0 +1,89 @@
+/* Implements arena.h */
+#include "arena.h"
+
+/* C Stdlib headers */
+#include <stdlib.h> /* malloc(), free() */
+
+/* Round a size up to a multiple of ARENA_ALIGN */
+static u64 align_up(u64 size) {
+  return (size + ARENA_ALIGN - 1) & ~(u64)(ARENA_ALIGN - 1);
+}
+/* Allocate a block holding at least capacity bytes */
+static arena_block_t *new_block(u64 capacity) {
+  capacity = align_up(MAX(capacity, ARENA_MIN_BLOCK));
+  /* The header and padding share the allocation */
+  u8 *raw = malloc(sizeof(arena_block_t) + ARENA_ALIGN + capacity);
+  if (!raw)
+    return NULL;
+  arena_block_t *block = (arena_block_t *)raw;
+  block->prev = NULL;
+  block->capacity = capacity;
+  block->data = (u8 *)(((uintptr_t)(raw + sizeof(arena_block_t))
+                        + ARENA_ALIGN - 1)
+                       & ~(uintptr_t)(ARENA_ALIGN - 1));
+  return block;
+}
+/* Free a chain of blocks, returning their total capacity */
+static u64 free_blocks(arena_block_t *block) {
+  u64 total = 0;
+  while (block) {
+    arena_block_t *prev = block->prev;
+    total += block->capacity;
+    free(block);
+    block = prev;
+  }
+  return total;
+}
+
+/* Allocate size bytes, aligned to ARENA_ALIGN, valid until the next reset */
+void *arena_alloc(arena_t *arena, u64 size) {
+  size = align_up(size);
+  if (!arena->block || arena->used + size > arena->block->capacity) {
+    /* Chain on a spare block if one fits, otherwise a new one twice as big */
+    arena_block_t *block = arena->spare;
+    if (block && block->capacity >= size) {
+      arena->spare = block->prev;
+    } else {
+      u64 capacity = arena->block ? arena->block->capacity * 2 : 0;
+      block = new_block(MAX(capacity, size));
+      if (!block)
+        return NULL;
+    }
+    block->prev = arena->block;
+    arena->block = block;
+    arena->used = 0;
+  }
+  void *ptr = arena->block->data + arena->used;
+  arena->used += size;
+  return ptr;
+}
+/* Free everything allocated, keeping the memory for reuse */
+void arena_reset(arena_t *arena) {
+  arena->used = 0;
+  if (!arena->spare && (!arena->block || !arena->block->prev))
+    return;
+  /* Replace the chain with one block that holds all of it */
+  u64 total = free_blocks(arena->block) + free_blocks(arena->spare);
+  arena->spare = NULL;
+  arena->block = new_block(total);
+}
+/* Remember the current point of an arena */
+arena_mark_t arena_mark(const arena_t *arena) {
+  return (arena_mark_t){arena->block, arena->used};
+}
+/* Free everything allocated since a mark, keeping the memory for reuse */
+void arena_rewind(arena_t *arena, arena_mark_t mark) {
+  while (arena->block != mark.block) {
+    arena_block_t *block = arena->block;
+    arena->block = block->prev;
+    block->prev = arena->spare;
+    arena->spare = block;
+  }
+  arena->used = mark.used;
+}
+/* Give an arena's memory back to the heap */
+void arena_free(arena_t *arena) {
+  free_blocks(arena->block);
+  free_blocks(arena->spare);
+  *arena = (arena_t){0};
+}
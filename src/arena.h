@@ -0,0 +1,55 @@
+/* Include guard */
+#if !defined(ARENA_H)
+#define ARENA_H
+
+/* Project headers */
+#include "math3d.h" /* Integer types */
+
+/* Consts */
+#define ARENA_ALIGN 64 /* Alignment of every allocation, a cache line */
+#define ARENA_MIN_BLOCK (64 * 1024) /* Smallest block an arena allocates */
+
+/*
+ * Arena (linear) allocator for transient data. Allocations bump a pointer
+ * through a block of memory and are never freed one by one; the whole
+ * arena is reset at once, usually once per frame. If a frame needs more
+ * than the block holds, more blocks are chained on, and the next reset
+ * replaces them with one block big enough for all of them, so once the
+ * arena has seen the largest frame it never touches the heap again.
+ *
+ * An arena is not locked: each thread that needs transient data uses its
+ * own.
+ */
+
+/* A block of an arena's memory */
+typedef struct arena_block {
+  struct arena_block *prev; /* The block filled before this one */
+  u64 capacity;             /* Bytes of data */
+  u8 *data;                 /* ARENA_ALIGN aligned */
+} arena_block_t;
+
+/* The type of an arena, zero initialized to start empty */
+typedef struct {
+  arena_block_t *block; /* The block being allocated from */
+  u64 used;             /* Bytes of it in use */
+  arena_block_t *spare; /* Blocks given back by arena_rewind() */
+} arena_t;
+
+/* A point in an arena to rewind to, see arena_mark() */
+typedef struct {
+  arena_block_t *block;
+  u64 used;
+} arena_mark_t;
+
+/* Allocate size bytes, aligned to ARENA_ALIGN, valid until the next reset */
+void *arena_alloc(arena_t *arena, u64 size);
+/* Free everything allocated, keeping the memory for reuse */
+void arena_reset(arena_t *arena);
+/* Remember the current point of an arena */
+arena_mark_t arena_mark(const arena_t *arena);
+/* Free everything allocated since a mark, keeping the memory for reuse */
+void arena_rewind(arena_t *arena, arena_mark_t mark);
+/* Give an arena's memory back to the heap */
+void arena_free(arena_t *arena);
+
+#endif /* ARENA_H */
@@ -0,0 +1,44 @@
+/* Implements dynres.h */
+#include "dynres.h"
+
+/* C Stdlib headers */
+#include <math.h> /* sqrtf() */
+
+/* Start a controller at full size */
+void dynres_init(dynres_t *dynres, f32 budget_ms) {
+  dynres->budget_ms = budget_ms;
+  dynres->scale = 1.0f;
+  dynres->total_ms = 0.0f;
+  dynres->frames = 0;
+}
+/* Record the time a frame took, returns true if the scale changed */
+bool dynres_update(dynres_t *dynres, f32 frame_ms) {
+  if (dynres->budget_ms <= 0.0f)
+    return false;
+  dynres->total_ms += frame_ms;
+  dynres->frames++;
+  f32 avg_ms = dynres->total_ms / dynres->frames;
+  f32 budget_ms = dynres->budget_ms;
+  if (dynres->frames < DYNRES_INTERVAL && avg_ms < budget_ms * DYNRES_SPIKE)
+    return false;
+  dynres->total_ms = 0.0f;
+  dynres->frames = 0;
+
+  f32 scale = dynres->scale;
+  if (avg_ms > budget_ms) {
+    /* Pixels go with the square of the scale */
+    scale *= sqrtf(budget_ms * DYNRES_TARGET / avg_ms);
+  } else if (avg_ms < budget_ms * DYNRES_HEADROOM) {
+    scale += DYNRES_STEP;
+  }
+  scale = MIN(MAX(scale, DYNRES_MIN_SCALE), 1.0f);
+  bool changed = scale != dynres->scale;
+  dynres->scale = scale;
+  return changed;
+}
+/* Get the size to render at, for an output of width x height */
+void dynres_size(const dynres_t *dynres, i32 width, i32 height,
+                 i32 *scaled_width, i32 *scaled_height) {
+  *scaled_width = MAX((i32)(width * dynres->scale + 0.5f), 1);
+  *scaled_height = MAX((i32)(height * dynres->scale + 0.5f), 1);
+}
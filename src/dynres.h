@@ -0,0 +1,46 @@
+/* Include guard */
+#if !defined(DYNRES_H)
+#define DYNRES_H
+
+/* C Stdlib headers */
+#include <stdbool.h> /* For boolean type */
+
+/* Project headers */
+#include "math3d.h" /* Integer types */
+
+/* Consts */
+#define DYNRES_MIN_SCALE 0.25f /* Smallest scale of each side */
+#define DYNRES_INTERVAL  8     /* Frames averaged between changes */
+#define DYNRES_SPIKE     1.5f  /* Over budget by this much acts at once */
+#define DYNRES_TARGET    0.85f /* Of the budget, aimed for when scaling down */
+#define DYNRES_HEADROOM  0.7f  /* Of the budget, under which it scales up */
+#define DYNRES_STEP      0.05f /* Scale added when scaling up */
+
+/*
+ * Dynamic resolution: scales the resolution frames are rendered at to
+ * hold their time within a budget, the output being upscaled to its full
+ * size when presented. Frame times are averaged over DYNRES_INTERVAL frames
+ * before acting, except for spikes, and there is a band between
+ * DYNRES_HEADROOM and the budget in which the scale is left alone, so it
+ * doesn't flicker between two sizes. It drops straight to the scale the
+ * budget allows, the cost of a frame going roughly with its pixel count,
+ * but climbs back a DYNRES_STEP at a time.
+ */
+
+/* The type of a dynamic resolution controller */
+typedef struct {
+  f32 budget_ms; /* 0 to always render at full size */
+  f32 scale;     /* Of each side, DYNRES_MIN_SCALE to 1 */
+  f32 total_ms;  /* Frame times since the last decision */
+  u32 frames;
+} dynres_t;
+
+/* Start a controller at full size, budget_ms 0 turning it off */
+void dynres_init(dynres_t *dynres, f32 budget_ms);
+/* Record the time a frame took, returns true if the scale changed */
+bool dynres_update(dynres_t *dynres, f32 frame_ms);
+/* Get the size to render at, for an output of width x height */
+void dynres_size(const dynres_t *dynres, i32 width, i32 height,
+                 i32 *scaled_width, i32 *scaled_height);
+
+#endif /* DYNRES_H */
@@ -9,191 +9,375 @@
 #include <string.h> /* memset(), memcpy(), strlen(), etc */
 
 /* Project headers */
-#include "math3d.h" /* Vector and matrix math */
+#include "dynres.h"   /* Dynamic resolution */
+#include "math3d.h"   /* Vector and matrix math */
+#include "mesh.h"     /* Indexed meshes */
+#include "pipeline.h" /* Geometry pipeline */
+#include "profiler.h" /* Frame profiler */
+#include "raster.h"   /* Triangle rasterization */
+#include "scene.h"    /* Scene hierarchy and frustum culling */
+#include "texture.h"  /* Mipmapped textures */
+#include "tiles.h"    /* Tiled, multi-threaded rasterization */
 
 /* Consts */
 #define WINDOW_WIDTH  1280          /* The width of the window on startup */
 #define WINDOW_HEIGHT 720           /* The height of the window on startup */
 #define WINDOW_TITLE  "Rasterizer"  /* The window title on startup */
 #define SCALE_DOWN    4             /* How much to scale down by */
+#define HEADLESS_FRAMES 100         /* Default frame count in headless mode */
+#define DUMP_PREFIX   "frame_"      /* Default path prefix for dumped frames */
+#define FRAME_BUFFERS 3             /* Frame buffers in flight when pipelined */
+#define FRAME_BUDGET  16.7f         /* Default frame time in a window, in ms */
+
+/* One set of buffers a frame is drawn into */
+typedef struct {
+  void *memory; /* From alloctarget(), holding the rest */
+  u32 *color;
+  f32 *depth;
+  f32 *coarse;
+  i32 width, height; /* Of the frame last drawn, up to the output's size */
+} framebuffer_t;
 
 /* Global state */
 struct {
   SDL_Window *window;
   SDL_Renderer *renderer;
+  SDL_Texture *texture;
   bool running;
+  bool headless;
+  bool quiet;
+  bool profile;
+  u64 frames;
+  u64 dump_every;
+  const char *dump_prefix;
   f32 delta_time;
-  f32 *z_buffer;
+  /*
+   * Frame buffers, used round robin when pipelined: one being drawn, one
+   * being rasterized and one being presented or written out
+   */
+  framebuffer_t buffers[FRAME_BUFFERS];
+  u64 pixel_capacity, block_capacity; /* Of each buffer, grown as needed */
+  u32 buffer_count;
+  u32 current;
+  bool pipelined;
+  bool eager_clear;
+  bool in_flight; /* A frame was submitted and not yet presented */
+  bool no_hiz;
   u64 ticks;
-  i32 width, height;
+  i32 width, height; /* Of the output, frames may be drawn smaller */
+  dynres_t dynres;
   f32 aspect_ratio;
   f32 fov;
   f32 near_z;
   f32 far_z;
   mat4_t projection;
+  mesh_t *mesh;
+  vec3_t mesh_pos; /* Where the centre of the mesh is placed */
+  instance_t instance;
+  scene_t scene;
 } app_state;
 
+/* The thread that writes out frames in pipelined headless mode */
+struct {
+  SDL_Thread *thread;
+  SDL_sem *ready; /* Posted when a frame is handed over */
+  SDL_sem *done;  /* Posted when the frame handed over is written */
+  const framebuffer_t *buffer;
+  u64 frame;
+  bool quit;
+} output;
+
 /* Data */
-tri_t quad_tris[12] = {
-    {
-        .v0 = {.x = 0.5, .y = -0.5, .z = 0.5},
-        .v1 = {.x = 0.5, .y = 0.5, .z = 0.5},
-        .v2 = {.x = -0.5, .y = -0.5, .z = 0.5},
-    },
-    {
-        .v0 = {.x = -0.5, .y = -0.5, .z = 0.5},
-        .v1 = {.x = 0.5, .y = 0.5, .z = 0.5},
-        .v2 = {.x = -0.5, .y = 0.5, .z = 0.5},
-    },
-    {
-        .v0 = {.x = 0.5, .y = -0.5, .z = -0.5},
-        .v1 = {.x = -0.5, .y = -0.5, .z = -0.5},
-        .v2 = {.x = 0.5, .y = 0.5, .z = -0.5},
-    },
-    {
-        .v0 = {.x = -0.5, .y = -0.5, .z = -0.5},
-        .v1 = {.x = -0.5, .y = 0.5, .z = -0.5},
-        .v2 = {.x = 0.5, .y = 0.5, .z = -0.5},
-    },
-    {
-        .v0 = {.x = 0.5, .y = 0.5, .z = -0.5},
-        .v1 = {.x = -0.5, .y = 0.5, .z = -0.5},
-        .v2 = {.x = 0.5, .y = 0.5, .z = 0.5},
-    },
-    {
-        .v0 = {.x = -0.5, .y = 0.5, .z = -0.5},
-        .v1 = {.x = -0.5, .y = 0.5, .z = 0.5},
-        .v2 = {.x = 0.5, .y = 0.5, .z = 0.5},
-    },
-    {
-        .v0 = {.x = 0.5, .y = -0.5, .z = -0.5},
-        .v1 = {.x = 0.5, .y = -0.5, .z = 0.5},
-        .v2 = {.x = -0.5, .y = -0.5, .z = -0.5},
-    },
-    {
-        .v0 = {.x = -0.5, .y = -0.5, .z = -0.5},
-        .v1 = {.x = 0.5, .y = -0.5, .z = 0.5},
-        .v2 = {.x = -0.5, .y = -0.5, .z = 0.5},
-    },
-    {
-        .v0 = {.x = 0.5, .y = 0.5, .z = -0.5},
-        .v1 = {.x = 0.5, .y = 0.5, .z = 0.5},
-        .v2 = {.x = 0.5, .y = -0.5, .z = -0.5},
-    },
-    {
-        .v0 = {.x = 0.5, .y = -0.5, .z = -0.5},
-        .v1 = {.x = 0.5, .y = 0.5, .z = 0.5},
-        .v2 = {.x = 0.5, .y = -0.5, .z = 0.5},
-    },
-    {
-        .v0 = {.x = -0.5, .y = 0.5, .z = -0.5},
-        .v1 = {.x = -0.5, .y = -0.5, .z = -0.5},
-        .v2 = {.x = -0.5, .y = 0.5, .z = 0.5},
-    },
-    {
-        .v0 = {.x = -0.5, .y = -0.5, .z = -0.5},
-        .v1 = {.x = -0.5, .y = -0.5, .z = 0.5},
-        .v2 = {.x = -0.5, .y = 0.5, .z = 0.5},
-    },
+/* Cube: 19 unique position/colour pairs shared by 12 triangles */
+f32 quad_x[19] = {
+    0.5, 0.5, -0.5, -0.5, -0.5, 0.5, -0.5, 0.5, -0.5, -0.5,
+    0.5, 0.5, -0.5, -0.5, 0.5, -0.5, 0.5, 0.5, -0.5,
+};
+f32 quad_y[19] = {
+    -0.5, 0.5, -0.5, -0.5, 0.5, -0.5, -0.5, 0.5, -0.5, 0.5,
+    0.5, 0.5, 0.5, 0.5, -0.5, -0.5, -0.5, -0.5, -0.5,
+};
+f32 quad_z[19] = {
+    0.5, 0.5, 0.5, 0.5, 0.5, -0.5, -0.5, -0.5, -0.5, -0.5,
+    -0.5, 0.5, -0.5, 0.5, 0.5, -0.5, -0.5, 0.5, 0.5,
+};
+#define RED   {0xff, 0x00, 0x00, 0xff}
+#define GREEN {0x00, 0xff, 0x00, 0xff}
+#define BLUE  {0x00, 0x00, 0xff, 0xff}
+col_t quad_cols[19] = {
+    RED, GREEN, BLUE, RED, BLUE, RED, GREEN, BLUE, RED, GREEN,
+    RED, BLUE, RED, GREEN, GREEN, BLUE, BLUE, BLUE, GREEN,
 };
-tri_col_t quad_cols[12] = {
-    {
-        .c0 = {0xff, 0x00, 0x00, 0xff},
-        .c1 = {0x00, 0xff, 0x00, 0xff},
-        .c2 = {0x00, 0x00, 0xff, 0xff},
-    },
-    {
-        .c0 = {0xff, 0x00, 0x00, 0xff},
-        .c1 = {0x00, 0xff, 0x00, 0xff},
-        .c2 = {0x00, 0x00, 0xff, 0xff},
-    },
-    {
-        .c0 = {0xff, 0x00, 0x00, 0xff},
-        .c1 = {0x00, 0xff, 0x00, 0xff},
-        .c2 = {0x00, 0x00, 0xff, 0xff},
-    },
-    {
-        .c0 = {0xff, 0x00, 0x00, 0xff},
-        .c1 = {0x00, 0xff, 0x00, 0xff},
-        .c2 = {0x00, 0x00, 0xff, 0xff},
-    },
-    {
-        .c0 = {0xff, 0x00, 0x00, 0xff},
-        .c1 = {0x00, 0xff, 0x00, 0xff},
-        .c2 = {0x00, 0x00, 0xff, 0xff},
-    },
-    {
-        .c0 = {0xff, 0x00, 0x00, 0xff},
-        .c1 = {0x00, 0xff, 0x00, 0xff},
-        .c2 = {0x00, 0x00, 0xff, 0xff},
-    },
-    {
-        .c0 = {0xff, 0x00, 0x00, 0xff},
-        .c1 = {0x00, 0xff, 0x00, 0xff},
-        .c2 = {0x00, 0x00, 0xff, 0xff},
-    },
-    {
-        .c0 = {0xff, 0x00, 0x00, 0xff},
-        .c1 = {0x00, 0xff, 0x00, 0xff},
-        .c2 = {0x00, 0x00, 0xff, 0xff},
-    },
-    {
-        .c0 = {0xff, 0x00, 0x00, 0xff},
-        .c1 = {0x00, 0xff, 0x00, 0xff},
-        .c2 = {0x00, 0x00, 0xff, 0xff},
-    },
-    {
-        .c0 = {0xff, 0x00, 0x00, 0xff},
-        .c1 = {0x00, 0xff, 0x00, 0xff},
-        .c2 = {0x00, 0x00, 0xff, 0xff},
-    },
-    {
-        .c0 = {0xff, 0x00, 0x00, 0xff},
-        .c1 = {0x00, 0xff, 0x00, 0xff},
-        .c2 = {0x00, 0x00, 0xff, 0xff},
-    },
-    {
-        .c0 = {0xff, 0x00, 0x00, 0xff},
-        .c1 = {0x00, 0xff, 0x00, 0xff},
-        .c2 = {0x00, 0x00, 0xff, 0xff},
-    },
+#undef RED
+#undef GREEN
+#undef BLUE
+u32 quad_indices[36] = {
+    0,  1,  2,    3,  1,  4,    5,  6,  7,    8,  9,  7,
+    10, 9,  11,   12, 13, 11,   5,  14, 15,   8,  14, 2,
+    10, 1,  16,   5,  1,  17,   12, 6,  4,    8,  18, 4,
 };
-mesh_t quad_mesh = {quad_tris, quad_cols, 12, {0.0, 0.0, 25.0}};
+mesh_t quad_mesh = {
+    .x = quad_x, .y = quad_y, .z = quad_z, .cols = quad_cols,
+    .vert_count = 19,
+    .indices = quad_indices, .tri_count = 12,
+};
+/* A mesh loaded with --mesh */
+mesh_t loaded_mesh;
+/* A texture loaded with --texture */
+texture_t loaded_texture;
 
-/* Create window */
-void create_window(void);
+/* Create window, returns false if its buffers couldn't be allocated */
+bool create_window(void);
 /* Destroy window */
 void destroy_window(void);
-/* Clear the screen */
-void clearscreen(col_t col);
-/* Write one pixel to the screen */
-void putpixel(u32 x, u32 y, col_t col);
-/* Write a triangle to the screen */
-void puttri(tri_t tri, tri_col_t cols);
+/*
+ * Set up in-memory render targets with no window (headless mode), returns
+ * false if they couldn't be allocated
+ */
+bool create_headless(i32 width, i32 height);
+/* Destroy in-memory render targets (headless mode) */
+void destroy_headless(void);
+/*
+ * (Re)allocate the frame buffers and streaming texture, returns false and
+ * keeps the old buffers if out of memory
+ */
+bool resize_buffers(void);
+/* Recompute the aspect ratio and projection matrix for the current size */
+void update_projection(void);
+/* Get the frame buffer drawn age frames before the current one */
+framebuffer_t *frame_buffer(u32 age);
+/* Upload a frame buffer and present it, upscaled to the window */
+void present(const framebuffer_t *buffer);
+/* Load a mesh file and place it in front of the camera */
+bool load_mesh(const char *path);
+
+/* Write a frame buffer to a binary PPM file, upscaled to the output size */
+bool write_ppm(const char *path, const framebuffer_t *buffer);
+/* Write a headless frame to a PPM file if it is one selected for dumping */
+void dump_frame(const framebuffer_t *buffer, u64 frame);
+/* Start the thread that writes out frames */
+bool output_start(void);
+/* Hand a finished frame to the output thread, once it is done with the last */
+void output_frame(const framebuffer_t *buffer, u64 frame);
+/* Wait for the output thread to finish and stop it */
+void output_stop(void);
+
+/* Update and draw one frame of the scene into the current frame buffer */
+void render_frame(void);
 
-/* Render a triangle */
-void render_tri(tri_t tri, tri_col_t cols);
-/* Render a mesh */
-void render_mesh(mesh_t mesh);
+/* Run interactively in a window */
+void run_window(void);
+/* Render a fixed number of frames offscreen, timing each one */
+void run_headless(void);
+
+/* Print command line usage */
+void usage(const char *prog) {
+  printf(
+      "Usage: %s [options]\n"
+      "  --headless         Render offscreen with no window and no vsync\n"
+      "  --frames N         Number of frames to render headless (default %d)\n"
+      "  --size WxH         Headless render resolution (default %dx%d)\n"
+      "  --dump-every N     Write every Nth headless frame as a PPM file\n"
+      "  --dump-prefix STR  Path prefix for dumped frames (default \"%s\")\n"
+      "  --quiet            Only print the headless timing summary\n"
+      "  --raster KERNEL    Rasterizer kernel: scalar, sse2 or avx2\n"
+      "                     (default: fastest the CPU supports)\n"
+      "  --threads N        Threads filling tiles (default: one per CPU)\n"
+      "  --mesh PATH        Draw a mesh file (binary or OBJ) instead of the\n"
+      "                     cube\n"
+      "  --texture PATH     Texture the mesh with a PPM file, if it has\n"
+      "                     texture coordinates\n"
+      "  --no-hiz           Disable coarse depth rejection\n"
+      "  --eager-clear      Clear the whole frame up front instead of each\n"
+      "                     tile as it is filled\n"
+      "  --deferred         Shade each pixel once, after depth testing,\n"
+      "                     from a visibility buffer\n"
+      "  --sort             Draw objects, and triangles within each tile,\n"
+      "                     front to back\n"
+      "  --depth-prepass    Fill each tile's depth before shading it\n"
+      "  --frame-budget MS  Scale the resolution down to keep frames within\n"
+      "                     MS ms, 0 for never (default %.1f in a window,\n"
+      "                     0 headless)\n"
+      "  --pipelined        Transform the next frame while this one is\n"
+      "                     rasterized, and present or write frames out\n"
+      "                     meanwhile (%d frame buffers)\n"
+      "  --profile          Print per stage timings and counters every %d\n"
+      "                     frames\n"
+      "  --trace PATH       Write per frame timings and counters to PATH,\n"
+      "                     as JSON if it ends in .json, CSV otherwise\n"
+      "  --help             Show this message\n",
+      prog, HEADLESS_FRAMES,
+      WINDOW_WIDTH / SCALE_DOWN, WINDOW_HEIGHT / SCALE_DOWN, DUMP_PREFIX,
+      FRAME_BUDGET, FRAME_BUFFERS, PROFILER_WINDOW
+  );
+}
 
 /* Entry point */
-int main() {
-  SDL_Init(SDL_INIT_VIDEO);
-  printf("INFO: Creating window...\n");
-  create_window();
+int main(int argc, char **argv) {
+  /* Parse command line */
+  i32 width = WINDOW_WIDTH / SCALE_DOWN;
+  i32 height = WINDOW_HEIGHT / SCALE_DOWN;
+  app_state.frames = HEADLESS_FRAMES;
+  app_state.dump_prefix = DUMP_PREFIX;
+  raster_init();
+  u32 threads = 0;
+  const char *trace_path = NULL;
+  const char *mesh_path = NULL;
+  const char *texture_path = NULL;
+  bool deferred = false, sorted = false, prepass = false;
+  f32 budget_ms = -1.0f;
+  for (i32 i = 1; i < argc; i++) {
+    bool has_val = i + 1 < argc;
+    if (strcmp(argv[i], "--headless") == 0) {
+      app_state.headless = true;
+    } else if (strcmp(argv[i], "--frames") == 0 && has_val) {
+      app_state.frames = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--size") == 0 && has_val) {
+      if (sscanf(argv[++i], "%dx%d", &width, &height) != 2
+          || width <= 0 || height <= 0) {
+        fprintf(stderr, "ERROR: Invalid size '%s'\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--dump-every") == 0 && has_val) {
+      app_state.dump_every = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--dump-prefix") == 0 && has_val) {
+      app_state.dump_prefix = argv[++i];
+    } else if (strcmp(argv[i], "--quiet") == 0) {
+      app_state.quiet = true;
+    } else if (strcmp(argv[i], "--raster") == 0 && has_val) {
+      raster_kernel_t kernel = 0;
+      i++;
+      while (kernel < RASTER_COUNT
+             && strcmp(argv[i], raster_kernel_name(kernel)) != 0)
+        kernel++;
+      if (!raster_set_kernel(kernel)) {
+        fprintf(stderr, "ERROR: Rasterizer '%s' is unavailable\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--threads") == 0 && has_val) {
+      threads = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--mesh") == 0 && has_val) {
+      mesh_path = argv[++i];
+    } else if (strcmp(argv[i], "--texture") == 0 && has_val) {
+      texture_path = argv[++i];
+    } else if (strcmp(argv[i], "--no-hiz") == 0) {
+      app_state.no_hiz = true;
+    } else if (strcmp(argv[i], "--eager-clear") == 0) {
+      app_state.eager_clear = true;
+    } else if (strcmp(argv[i], "--deferred") == 0) {
+      deferred = true;
+    } else if (strcmp(argv[i], "--sort") == 0) {
+      sorted = true;
+    } else if (strcmp(argv[i], "--depth-prepass") == 0) {
+      prepass = true;
+    } else if (strcmp(argv[i], "--frame-budget") == 0 && has_val) {
+      budget_ms = strtof(argv[++i], NULL);
+    } else if (strcmp(argv[i], "--pipelined") == 0) {
+      app_state.pipelined = true;
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      app_state.profile = true;
+    } else if (strcmp(argv[i], "--trace") == 0 && has_val) {
+      trace_path = argv[++i];
+    } else if (strcmp(argv[i], "--help") == 0) {
+      usage(argv[0]);
+      return 0;
+    } else {
+      fprintf(stderr, "ERROR: Unknown or incomplete option '%s'\n", argv[i]);
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
   app_state.fov = 60;
   app_state.near_z = 0.1;
   app_state.far_z = 999.0;
-  app_state.projection = projection(
-      app_state.fov,
-      app_state.aspect_ratio,
-      app_state.near_z, app_state.far_z
-  );
   app_state.ticks = 0;
+  app_state.buffer_count = app_state.pipelined ? FRAME_BUFFERS : 1;
+  if (budget_ms < 0.0f)
+    budget_ms = app_state.headless ? 0.0f : FRAME_BUDGET;
+  dynres_init(&app_state.dynres, budget_ms);
+  app_state.mesh = &quad_mesh;
+  app_state.mesh_pos = (vec3_t){0.0, 0.0, 2.5};
+  mesh_compute_bounds(&quad_mesh);
+  if (!tiles_init(threads))
+    fprintf(stderr, "ERROR: Failed to start all tile workers\n");
+  tiles_set_deferred(deferred);
+  tiles_set_sorted(sorted);
+  tiles_set_prepass(prepass);
+  if ((app_state.profile || trace_path) && !profiler_init(trace_path)) {
+    fprintf(stderr, "ERROR: Failed to open trace '%s'\n", trace_path);
+    return 1;
+  }
+  printf(
+      "INFO: Using %s rasterizer on %u threads\n",
+      raster_kernel_name(raster_get_kernel()), tiles_thread_count()
+  );
+  if (mesh_path && !load_mesh(mesh_path)) {
+    fprintf(stderr, "ERROR: Failed to load mesh '%s'\n", mesh_path);
+    return 1;
+  }
+  if (texture_path) {
+    if (!texture_load(texture_path, &loaded_texture)) {
+      fprintf(stderr, "ERROR: Failed to load texture '%s'\n", texture_path);
+      return 1;
+    }
+    if (!app_state.mesh->u)
+      printf("INFO: Mesh has no texture coordinates, drawing untextured\n");
+  }
+  app_state.instance = (instance_t){
+      .model = translation(app_state.mesh_pos),
+      .color = {0xff, 0xff, 0xff, 0xff},
+      .texture = texture_path ? &loaded_texture : NULL,
+  };
+  app_state.scene.front_to_back = sorted;
+  if (!scene_add(&app_state.scene, app_state.mesh, &app_state.instance, 1)
+      || !scene_build(&app_state.scene)) {
+    fprintf(stderr, "ERROR: Failed to build the scene\n");
+    return 1;
+  }
+  if (app_state.headless) {
+    SDL_Init(SDL_INIT_TIMER);
+    printf("INFO: Rendering %dx%d headless...\n", width, height);
+    if (!create_headless(width, height)) {
+      fprintf(stderr, "ERROR: Failed to allocate %dx%d frame buffers\n",
+              width, height);
+      return 1;
+    }
+    update_projection();
+    run_headless();
+    destroy_headless();
+  } else {
+    SDL_Init(SDL_INIT_VIDEO);
+    printf("INFO: Creating window...\n");
+    if (!create_window()) {
+      fprintf(stderr, "ERROR: Failed to allocate the frame buffers\n");
+      destroy_window();
+      return 1;
+    }
+    update_projection();
+    run_window();
+    printf("INFO: Destroying window...\n");
+    destroy_window();
+  }
+  if (app_state.profile)
+    profiler_report();
+  profiler_quit();
+  tiles_quit();
+  pipeline_quit();
+  scene_free(&app_state.scene);
+  mesh_free(&loaded_mesh);
+  texture_free(&loaded_texture);
+  SDL_Quit();
+  return 0;
+}
+
+/* Run interactively in a window */
+void run_window(void) {
   /* Main loop */
   while (app_state.running) {
     /* DeltaTime - part 1 */
     u64 start = SDL_GetPerformanceCounter();
+    profiler_frame_begin();
     /* Update ticks */
     app_state.ticks++;
     /* Poll through events */
@@ -205,18 +389,20 @@ int main() {
         break;
       case SDL_WINDOWEVENT: {
         if (e.window.event == SDL_WINDOWEVENT_RESIZED) {
+          /* Drop any frame in flight, its buffers are about to go */
+          pipeline_finish();
+          app_state.in_flight = false;
+          i32 old_width = app_state.width, old_height = app_state.height;
           app_state.width = e.window.data1 / SCALE_DOWN;
           app_state.height = e.window.data2 / SCALE_DOWN;
-          app_state.aspect_ratio = (f32)app_state.height / (f32)app_state.width;
-          app_state.projection = projection(
-              app_state.fov,
-              app_state.aspect_ratio,
-              app_state.near_z, app_state.far_z
-          );
-          app_state.z_buffer = realloc(
-              app_state.z_buffer,
-              sizeof(f32) * app_state.width * app_state.height
-          );
+          if (!resize_buffers()) {
+            fprintf(stderr, "ERROR: Failed to resize frame buffers to %dx%d, "
+                    "keeping %dx%d\n", app_state.width, app_state.height,
+                    old_width, old_height);
+            app_state.width = old_width;
+            app_state.height = old_height;
+          }
+          update_projection();
           SDL_RenderSetLogicalSize(
               app_state.renderer,
               app_state.width, app_state.height
@@ -227,56 +413,174 @@ int main() {
         break;
       }
     }
-    /* Clear screen */
-    clearscreen((col_t){0x00, 0x00, 0x00, 0xff});
-    for (register u64 i = 0; i < (u64)app_state.width * app_state.height; i++) {
-      app_state.z_buffer[i] = INFINITY;
-    }
-
-    /* Update scene */
-    // mat4_t rotation = euler_rot((vec3_t){ DEGTORAD(0.5), DEGTORAD(0.3), 0.0
-    // });
-    mat4_t rotation = euler_rot((vec3_t){DEGTORAD(0.7), DEGTORAD(0.5), 0.0});
-    for (u64 i = 0; i < quad_mesh.tri_count; i++) {
-      /* Get triangle */
-      tri_t tri = quad_mesh.tris[i];
-      /* Create 4D vectors for matrix multiplication */
-      vec4_t v0 = {tri.v0.x, tri.v0.y, tri.v0.z, 1};
-      vec4_t v1 = {tri.v1.x, tri.v1.y, tri.v1.z, 1};
-      vec4_t v2 = {tri.v2.x, tri.v2.y, tri.v2.z, 1};
-      v0 = mulm4v4(rotation, v0);
-      v1 = mulm4v4(rotation, v1);
-      v2 = mulm4v4(rotation, v2);
-      quad_mesh.tris[i].v0 = (vec3_t){v0.x, v0.y, v0.z};
-      quad_mesh.tris[i].v1 = (vec3_t){v1.x, v1.y, v1.z};
-      quad_mesh.tris[i].v2 = (vec3_t){v2.x, v2.y, v2.z};
-    }
-    /* Draw scene */
-    render_mesh(quad_mesh);
+    /* Draw scene, timing it without the wait for vsync */
+    render_frame();
+    u64 rendered = SDL_GetPerformanceCounter();
 
-    /* Present window */
-    SDL_RenderPresent(app_state.renderer);
+    /*
+     * Present window. When pipelined, that is the previous frame, which
+     * render_frame() saw finished; the SDL renderer must stay on this
+     * thread, so presenting overlaps the workers filling this frame.
+     */
+    prof_stage_t prev_stage = profiler_push(PROF_PRESENT);
+    if (!app_state.pipelined)
+      present(frame_buffer(0));
+    else if (app_state.in_flight)
+      present(frame_buffer(1));
+    profiler_pop(prev_stage);
+    app_state.in_flight = app_state.pipelined;
+    profiler_frame_end(
+        (u64)frame_buffer(0)->width * frame_buffer(0)->height
+    );
+    app_state.current = (app_state.current + 1) % app_state.buffer_count;
+    dynres_update(&app_state.dynres, (rendered - start)
+                  / (f32)SDL_GetPerformanceFrequency() * 1000.0f);
+    if (app_state.profile && app_state.ticks % PROFILER_WINDOW == 0)
+      profiler_report();
 
     /* DeltaTime - part 2 */
     if (app_state.ticks % 100 == 0) {
-      char title[48] = "";
+      char title[80] = "";
       f32 fps =
           app_state.delta_time > 0 ? 1000.0f / app_state.delta_time : 1.0f;
-      sprintf(title, "FPS: %f\tDelta Time: %f", fps, app_state.delta_time);
+      sprintf(title, "FPS: %f\tDelta Time: %f\tScale: %.2f", fps,
+              app_state.delta_time, app_state.dynres.scale);
       SDL_SetWindowTitle(app_state.window, title);
     }
     u64 end = SDL_GetPerformanceCounter();
     app_state.delta_time =
         (end - start) / (f32)SDL_GetPerformanceFrequency() * 1000.0f;
   }
-  printf("INFO: Destroying window...\n");
-  destroy_window();
-  SDL_Quit();
-  return 0;
+  pipeline_finish();
 }
+/* Render a fixed number of frames offscreen, timing each one */
+void run_headless(void) {
+  f64 total = 0.0, best = INFINITY, worst = 0.0;
+  f32 min_scale = 1.0f;
+  f64 freq = (f64)SDL_GetPerformanceFrequency();
+  if (app_state.pipelined && !output_start()) {
+    fprintf(stderr, "ERROR: Failed to start the output thread\n");
+    app_state.pipelined = false;
+  }
+  for (u64 frame = 0; frame < app_state.frames; frame++) {
+    app_state.ticks++;
+    u64 start = SDL_GetPerformanceCounter();
+    profiler_frame_begin();
+    render_frame();
+    /* When pipelined, the previous frame is finished now */
+    if (app_state.pipelined && frame > 0)
+      output_frame(frame_buffer(1), frame - 1);
+    profiler_frame_end(
+        (u64)frame_buffer(0)->width * frame_buffer(0)->height
+    );
+    u64 end = SDL_GetPerformanceCounter();
+    f64 ms = (end - start) / freq * 1000.0;
+    app_state.delta_time = ms;
+    dynres_update(&app_state.dynres, ms);
+    min_scale = MIN(min_scale, app_state.dynres.scale);
+    total += ms;
+    best = MIN(best, ms);
+    worst = MAX(worst, ms);
+    if (!app_state.quiet)
+      printf("frame %llu: %.3f ms\n", (unsigned long long)frame, ms);
+    /* Dump selected frames (outside the timed region) */
+    if (!app_state.pipelined)
+      dump_frame(frame_buffer(0), frame);
+    if (app_state.profile && (frame + 1) % PROFILER_WINDOW == 0)
+      profiler_report();
+    app_state.current = (app_state.current + 1) % app_state.buffer_count;
+  }
+  /* Finish the last frame and write it out */
+  pipeline_finish();
+  if (app_state.pipelined) {
+    if (app_state.frames > 0)
+      output_frame(frame_buffer(1), app_state.frames - 1);
+    output_stop();
+  }
+  if (app_state.frames > 0) {
+    f64 avg = total / app_state.frames;
+    printf(
+        "INFO: %llu frames, avg %.3f ms (%.1f FPS), min %.3f ms, max %.3f ms\n",
+        (unsigned long long)app_state.frames, avg, 1000.0 / avg, best, worst
+    );
+  }
+  if (app_state.dynres.budget_ms > 0.0f) {
+    printf("INFO: Resolution scale down to %.2f, %.2f at the end\n",
+           min_scale, app_state.dynres.scale);
+  }
+}
+/* Update and draw one frame of the scene into the current frame buffer */
+void render_frame(void) {
+  framebuffer_t *buffer = frame_buffer(0);
+  dynres_size(&app_state.dynres, app_state.width, app_state.height,
+              &buffer->width, &buffer->height);
+  target_t target = {
+      buffer->color, buffer->depth,
+      app_state.no_hiz ? NULL : buffer->coarse,
+      buffer->width, buffer->height,
+      NULL, /* The tiles add a visibility buffer if shading deferred */
+      FILL_COLOR, /* The tiles switch modes for a depth pre-pass */
+  };
+  /* Clear screen, unless it is left to the tiles */
+  col_t clear_col = {0x00, 0x00, 0x00, 0xff};
+  if (app_state.eager_clear) {
+    prof_stage_t prev_stage = profiler_push(PROF_CLEAR);
+    cleartarget(&target, clear_col);
+    profiler_pop(prev_stage);
+  }
 
-/* Create window */
-void create_window(void) {
+  /*
+   * Update scene: spin the mesh about its centre. The rotation is rebuilt
+   * from the tick count each frame, so it doesn't drift, and the mesh's
+   * vertices are left alone.
+   */
+  mat4_t rotation = euler_rot((vec3_t){
+      DEGTORAD(0.7) * app_state.ticks, DEGTORAD(0.5) * app_state.ticks, 0.0,
+  });
+  app_state.instance.model = mulm4(
+      translation(app_state.mesh_pos),
+      mulm4(rotation, translation(negate_v3(app_state.mesh->bounds.center)))
+  );
+  scene_refit(&app_state.scene);
+  /*
+   * Draw scene. When pipelined, this only waits for the previous frame to
+   * finish before handing this one to the tile workers.
+   */
+  pipeline_begin(&target, app_state.projection);
+  if (!app_state.eager_clear)
+    pipeline_clear(clear_col);
+  scene_draw(&app_state.scene, app_state.projection);
+  if (app_state.pipelined)
+    pipeline_submit();
+  else
+    pipeline_end();
+}
+
+/* Load a mesh file and place it in front of the camera */
+bool load_mesh(const char *path) {
+  u64 start = SDL_GetPerformanceCounter();
+  if (!mesh_load(path, &loaded_mesh))
+    return false;
+  u64 end = SDL_GetPerformanceCounter();
+  printf(
+      "INFO: Loaded '%s' (%u vertices, %u triangles) in %.1f ms\n",
+      path, loaded_mesh.vert_count, loaded_mesh.tri_count,
+      (end - start) / (f64)SDL_GetPerformanceFrequency() * 1000.0
+  );
+  /* Centre the bounds and back off until they fit the view */
+  if (loaded_mesh.vert_count > 0) {
+    const bounds_t *bounds = &loaded_mesh.bounds;
+    vec3_t extent = add_v3(bounds->max, negate_v3(bounds->min));
+    f32 radius = 0.5f * sqrtf(dot_v3(extent, extent));
+    f32 dist = 1.2f * radius / tanf(DEGTORAD(app_state.fov) / 2);
+    app_state.mesh_pos = (vec3_t){0.0, 0.0, dist};
+  }
+  app_state.mesh = &loaded_mesh;
+  return true;
+}
+
+/* Create window, returns false if its buffers couldn't be allocated */
+bool create_window(void) {
   app_state.window = SDL_CreateWindow(WINDOW_TITLE, 0, 0, WINDOW_WIDTH,
                                       WINDOW_HEIGHT, SDL_WINDOW_RESIZABLE);
   app_state.renderer =
@@ -286,173 +590,181 @@ void create_window(void) {
                            WINDOW_HEIGHT / SCALE_DOWN);
   app_state.width = WINDOW_WIDTH / SCALE_DOWN;
   app_state.height = WINDOW_HEIGHT / SCALE_DOWN;
-  app_state.z_buffer = malloc(sizeof(f32) * app_state.width * app_state.height);
-  app_state.aspect_ratio = (f32)app_state.height / (f32)app_state.width;
+  if (!resize_buffers())
+    return false;
   app_state.running = true;
+  return true;
 }
 /* Destroy window */
 void destroy_window(void) {
+  SDL_DestroyTexture(app_state.texture);
   SDL_DestroyRenderer(app_state.renderer);
   SDL_DestroyWindow(app_state.window);
+  destroy_headless();
 }
-/* Clear the screen */
-void clearscreen(col_t col) {
-  SDL_SetRenderDrawColor(app_state.renderer, col.r, col.g, col.b, col.a);
-  SDL_RenderClear(app_state.renderer);
+/*
+ * Set up in-memory render targets with no window (headless mode), returns
+ * false if they couldn't be allocated
+ */
+bool create_headless(i32 width, i32 height) {
+  app_state.width = width;
+  app_state.height = height;
+  return resize_buffers();
 }
-/* Write one pixel to the screen */
-void putpixel(u32 x, u32 y, col_t col) {
-  SDL_SetRenderDrawColor(app_state.renderer, col.r, col.g, col.b, col.a);
-  SDL_RenderDrawPoint(app_state.renderer, x, y);
-}
-/* Write a triangle to the screen */
-typedef struct {
-  i32 x, y;
-} vec2_int_t;
-/* Helper */
-inline i32 helper_puttri(vec2_int_t a, vec2_int_t b, vec2_int_t p) {
-  vec2_int_t ab = (vec2_int_t){b.x - a.x, b.y - a.y};
-  vec2_int_t ap = (vec2_int_t){p.x - a.x, p.y - a.y};
-  return (ab.x * ap.y) - (ab.y * ap.x);
-}
-void puttri(tri_t tri, tri_col_t cols) {
-  vec2_int_t v0 = (vec2_int_t){tri.v0.x, tri.v0.y};
-  vec2_int_t v1 = (vec2_int_t){tri.v1.x, tri.v1.y};
-  vec2_int_t v2 = (vec2_int_t){tri.v2.x, tri.v2.y};
-  f32 z0 = tri.v0.z;
-  f32 z1 = tri.v1.z;
-  f32 z2 = tri.v2.z;
-  /* Get bounding box of triangle */
-  u32 maxX = MAX(MAX(v0.x, v1.x), v2.x);
-  u32 maxY = MAX(MAX(v0.y, v1.y), v2.y);
-  u32 minX = MIN(MIN(v0.x, v1.x), v2.x);
-  u32 minY = MIN(MIN(v0.y, v1.y), v2.y);
-
-  /* Ensure correct winding order */
-  if (helper_puttri(v0, v1, v2) < 0) {
-    SWAP(v1, v0);
-    SWAP(z1, z0);
+/* Destroy in-memory render targets (headless mode) */
+void destroy_headless(void) {
+  for (u32 i = 0; i < app_state.buffer_count; i++) {
+    free(app_state.buffers[i].memory);
   }
-
-  /* Compute 'area' */
-  f32 area = helper_puttri(v0, v1, v2);
-
-  /* Loop over bounding box */
-  for (u32 y = minY; y < maxY; y++) {
-    for (u32 x = minX; x < maxX; x++) {
-      vec2_int_t point = (vec2_int_t){x, y};
-
-      /* Find barycentric coordinates - part 1 */
-      f32 w0 = helper_puttri(v1, v2, point);
-      f32 w1 = helper_puttri(v2, v0, point);
-      f32 w2 = helper_puttri(v0, v1, point);
-
-      /* Is it a point in the triangle? */
-      bool inTri = w0 >= 0 && w1 >= 0 && w2 >= 0;
-      if (inTri) {
-        /* Find barycentric coordinates - part 2 */
-        f32 alpha = w0 / area;
-        f32 beta = w1 / area;
-        f32 gamma = w2 / area;
-
-        /* Interpolation - z */
-        f32 z = alpha * z0 + beta * z1 + gamma * z2;
-
-        /* Draw pixel */
-        if (z<app_state.z_buffer[(y * app_state.width)+(x%app_state.width)]) {
-          /* Interpolation - col */
-          col_t col;
-          col.r = alpha * cols.c0.r + beta * cols.c1.r + gamma * cols.c2.r;
-          col.g = alpha * cols.c0.g + beta * cols.c1.g + gamma * cols.c2.g;
-          col.b = alpha * cols.c0.b + beta * cols.c1.b + gamma * cols.c2.b;
-          /* Draw pixel to screen */
-          putpixel(x, y, col);
-          /* Update z buffer */
-          app_state.z_buffer[(y * app_state.width)+(x%app_state.width)] = z;
+}
+/*
+ * (Re)allocate the frame buffers and streaming texture, returns false and
+ * keeps the old buffers if out of memory
+ */
+bool resize_buffers(void) {
+  /*
+   * Buffers are only grown, and to at least twice their size, so dragging
+   * a window edge doesn't reallocate them on every event
+   */
+  u64 pixels = (u64)app_state.width * app_state.height;
+  u64 blocks = (u64)HIZ_SIZE(app_state.width) * HIZ_SIZE(app_state.height);
+  if (pixels > app_state.pixel_capacity || blocks > app_state.block_capacity) {
+    u64 pixel_capacity = MAX(app_state.pixel_capacity * 2, pixels);
+    u64 block_capacity = MAX(app_state.block_capacity * 2, blocks);
+    /* Allocate every new buffer before letting go of any old one */
+    target_t targets[FRAME_BUFFERS] = {0};
+    void *memory[FRAME_BUFFERS] = {0};
+    for (u32 i = 0; i < app_state.buffer_count; i++) {
+      memory[i] = alloctarget(&targets[i], pixel_capacity, block_capacity);
+      if (!memory[i]) {
+        for (u32 j = 0; j < i; j++) {
+          free(memory[j]);
         }
+        return false;
       }
     }
+    for (u32 i = 0; i < app_state.buffer_count; i++) {
+      framebuffer_t *buffer = &app_state.buffers[i];
+      free(buffer->memory);
+      buffer->memory = memory[i];
+      buffer->color = targets[i].color;
+      buffer->depth = targets[i].depth;
+      buffer->coarse = targets[i].coarse;
+    }
+    app_state.pixel_capacity = pixel_capacity;
+    app_state.block_capacity = block_capacity;
   }
+  if (!app_state.renderer)
+    return true;
+  if (app_state.texture)
+    SDL_DestroyTexture(app_state.texture);
+  app_state.texture = SDL_CreateTexture(
+      app_state.renderer,
+      SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+      app_state.width, app_state.height
+  );
+  return true;
 }
-
-/* Render a triangle */
-void render_tri(tri_t tri, tri_col_t cols) {
-  /* Create 4D vectors for matrix multiplication */
-  vec4_t v0 = {tri.v0.x, tri.v0.y, tri.v0.z, 1};
-  vec4_t v1 = {tri.v1.x, tri.v1.y, tri.v1.z, 1};
-  vec4_t v2 = {tri.v2.x, tri.v2.y, tri.v2.z, 1};
-
-  /* Carry out matrix multiplication */
-  v0 = mulm4v4(app_state.projection, v0);
-  v1 = mulm4v4(app_state.projection, v1);
-  v2 = mulm4v4(app_state.projection, v2);
-  if (v0.w != 0) {
-    v0.x /= v0.w;
-    v0.y /= v0.w;
-    v0.z /= v0.w;
-  }
-  if (v1.w != 0) {
-    v1.x /= v1.w;
-    v1.y /= v1.w;
-    v1.z /= v1.w;
+/* Recompute the aspect ratio and projection matrix for the current size */
+void update_projection(void) {
+  app_state.aspect_ratio = (f32)app_state.height / (f32)app_state.width;
+  app_state.projection = projection(
+      app_state.fov,
+      app_state.aspect_ratio,
+      app_state.near_z, app_state.far_z
+  );
+}
+/* Get the frame buffer drawn age frames before the current one */
+framebuffer_t *frame_buffer(u32 age) {
+  u32 count = app_state.buffer_count;
+  return &app_state.buffers[(app_state.current + count - age % count) % count];
+}
+/* Upload a frame buffer and present it, upscaled to the window */
+void present(const framebuffer_t *buffer) {
+  /*
+   * The texture is the output's size, and a frame drawn smaller only
+   * fills its top left, which is stretched over the window
+   */
+  SDL_Rect rect = {0, 0, buffer->width, buffer->height};
+  SDL_UpdateTexture(
+      app_state.texture, &rect, buffer->color, buffer->width * sizeof(u32)
+  );
+  SDL_RenderCopy(app_state.renderer, app_state.texture, &rect, NULL);
+  SDL_RenderPresent(app_state.renderer);
+}
+/* Write a frame buffer to a binary PPM file, upscaled to the output size */
+bool write_ppm(const char *path, const framebuffer_t *buffer) {
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return false;
+  u8 *row = malloc(3 * app_state.width);
+  if (!row) {
+    fclose(file);
+    return false;
   }
-  if (v2.w != 0) {
-    v2.x /= v2.w;
-    v2.y /= v2.w;
-    v2.z /= v2.w;
+  fprintf(file, "P6\n%d %d\n255\n", app_state.width, app_state.height);
+  for (i32 y = 0; y < app_state.height; y++) {
+    /* Nearest pixel of a frame drawn smaller */
+    const u32 *src_row = buffer->color
+        + ((i64)y * buffer->height / app_state.height) * buffer->width;
+    for (i32 x = 0; x < app_state.width; x++) {
+      u32 pixel = src_row[(i64)x * buffer->width / app_state.width];
+      row[3 * x + 0] = pixel >> 24;
+      row[3 * x + 1] = pixel >> 16;
+      row[3 * x + 2] = pixel >> 8;
+    }
+    fwrite(row, 3, app_state.width, file);
   }
-
-  /* Scale into view */
-  v0.x += 1.0;
-  v0.x *= 0.5 * app_state.width;
-  v1.x += 1.0;
-  v1.x *= 0.5 * app_state.width;
-  v2.x += 1.0;
-  v2.x *= 0.5 * app_state.width;
-  v0.y += 1.0;
-  v0.y *= 0.5 * app_state.height;
-  v1.y += 1.0;
-  v1.y *= 0.5 * app_state.height;
-  v2.y += 1.0;
-  v2.y *= 0.5 * app_state.height;
-
-  SDL_SetRenderDrawColor(app_state.renderer, 0x7f, 0x7f, 0x7f, 0xff);
-  SDL_RenderDrawLine(app_state.renderer, v0.x, v0.y, v1.x, v1.y);
-  SDL_RenderDrawLine(app_state.renderer, v2.x, v2.y, v1.x, v1.y);
-  SDL_RenderDrawLine(app_state.renderer, v2.x, v2.y, v0.x, v0.y);
-  putpixel(v0.x, v0.y, (col_t){0xff, 0xff, 0xff, 0xff});
-  putpixel(v1.x, v1.y, (col_t){0xff, 0xff, 0xff, 0xff});
-  putpixel(v2.x, v2.y, (col_t){0xff, 0xff, 0xff, 0xff});
-  tri_t render_tri = {
-      VTOVEC3(v0),
-      VTOVEC3(v1),
-      VTOVEC3(v2),
-  };
-  puttri(render_tri, cols);
+  free(row);
+  return fclose(file) == 0;
 }
-/* Render a mesh */
-void render_mesh(mesh_t mesh) {
-  for (u64 i = 0; i < mesh.tri_count; i++) {
-    /* Get triangle from mesh */
-    tri_t tri = mesh.tris[i];
-    vec3_t line1 = add_v3(tri.v1, negate_v3(tri.v0));
-    vec3_t line2 = add_v3(tri.v2, negate_v3(tri.v0));
-    vec3_t normal = normalize_v3(cross_v3(line1, line2));
-    if (normal.z > 0)
-      continue;
-    /* Create 4D vectors for matrix multiplication */
-    vec4_t v0 = {tri.v0.x, tri.v0.y, tri.v0.z, 1};
-    vec4_t v1 = {tri.v1.x, tri.v1.y, tri.v1.z, 1};
-    vec4_t v2 = {tri.v2.x, tri.v2.y, tri.v2.z, 1};
-    /* Translate into world space */
-    mat4_t trans = translation(mesh.pos);
-    v0 = mulm4v4(trans, v0);
-    v1 = mulm4v4(trans, v1);
-    v2 = mulm4v4(trans, v2);
-    /* Put back in triangle */
-    tri.v0 = VTOVEC3(v0);
-    tri.v1 = VTOVEC3(v1);
-    tri.v2 = VTOVEC3(v2);
-    render_tri(tri, mesh.cols[i]);
+/* Write a headless frame to a PPM file if it is one selected for dumping */
+void dump_frame(const framebuffer_t *buffer, u64 frame) {
+  if (!app_state.dump_every || frame % app_state.dump_every != 0)
+    return;
+  char path[256];
+  snprintf(path, sizeof(path), "%s%05llu.ppm",
+           app_state.dump_prefix, (unsigned long long)frame);
+  if (!write_ppm(path, buffer))
+    fprintf(stderr, "ERROR: Failed to write '%s'\n", path);
+}
+
+/* Output thread entry point */
+static int output_main(void *data) {
+  (void)data;
+  while (true) {
+    SDL_SemWait(output.ready);
+    if (output.quit)
+      break;
+    dump_frame(output.buffer, output.frame);
+    SDL_SemPost(output.done);
   }
+  return 0;
+}
+/* Start the thread that writes out frames */
+bool output_start(void) {
+  output.ready = SDL_CreateSemaphore(0);
+  output.done = SDL_CreateSemaphore(1);
+  if (!output.ready || !output.done)
+    return false;
+  output.quit = false;
+  output.thread = SDL_CreateThread(output_main, "output", NULL);
+  return output.thread != NULL;
+}
+/* Hand a finished frame to the output thread, once it is done with the last */
+void output_frame(const framebuffer_t *buffer, u64 frame) {
+  SDL_SemWait(output.done);
+  output.buffer = buffer;
+  output.frame = frame;
+  SDL_SemPost(output.ready);
+}
+/* Wait for the output thread to finish and stop it */
+void output_stop(void) {
+  SDL_SemWait(output.done);
+  output.quit = true;
+  SDL_SemPost(output.ready);
+  SDL_WaitThread(output.thread, NULL);
+  SDL_DestroySemaphore(output.ready);
+  SDL_DestroySemaphore(output.done);
+  output.thread = NULL;
 }
@@ -1,13 +1,19 @@
 /* Implements math3d.h */
 #include "math3d.h"
 
+/* SIMD intrinsics (x86 only) */
+#if defined(__x86_64__) || defined(__i386__)
+#define MATH3D_X86
+#include <immintrin.h>
+#endif
+
 /* Dot product of two 2D vectors */
 f32 dot_v2(vec2_t a, vec2_t b) {
   return (a.x * b.x + a.y * b.y);
 }
 /* Dot product of two 3D vectors */
 f32 dot_v3(vec3_t a, vec3_t b) {
-  return (a.x * b.x + a.y * b.y);
+  return (a.x * b.x + a.y * b.y + a.z * b.z);
 }
 /* Cross product of two 2D vectors - imaginary z component */
 f32 cross_v2(vec2_t a, vec2_t b) {
@@ -196,6 +202,339 @@ vec4_t mulm4v4(mat4_t a, vec4_t b) {
   return res;
 }
 
+/* Multiply n 4D vectors by a 4x4 matrix (scalar reference) */
+void mulm4v4_batch_ref(const mat4_t *a, const vec4_t *in, vec4_t *out, u64 n) {
+  for (u64 i = 0; i < n; i++) {
+    out[i] = mulm4v4(*a, in[i]);
+  }
+}
+/* Multiply n points (w = 1) in x, y, z streams by a 4x4 matrix (reference) */
+void mulm4p3_soa_ref(const mat4_t *a, const f32 *x, const f32 *y,
+                     const f32 *z, f32 *out_x, f32 *out_y, f32 *out_z,
+                     f32 *out_w, u64 n) {
+  const f32 *m = a->vals;
+  for (u64 i = 0; i < n; i++) {
+    f32 px = x[i], py = y[i], pz = z[i];
+    out_x[i] = m[0] * px + m[1] * py + m[2] * pz + m[3];
+    out_y[i] = m[4] * px + m[5] * py + m[6] * pz + m[7];
+    out_z[i] = m[8] * px + m[9] * py + m[10] * pz + m[11];
+    out_w[i] = m[12] * px + m[13] * py + m[14] * pz + m[15];
+  }
+}
+/* Normalize n 3D vectors (scalar reference) */
+void normalize_v3_batch_ref(const vec3_t *in, vec3_t *out, u64 n) {
+  for (u64 i = 0; i < n; i++) {
+    out[i] = normalize_v3(in[i]);
+  }
+}
+/* Cross products of n pairs of 3D vectors (scalar reference) */
+void cross_v3_batch_ref(const vec3_t *a, const vec3_t *b, vec3_t *out, u64 n) {
+  for (u64 i = 0; i < n; i++) {
+    out[i] = cross_v3(a[i], b[i]);
+  }
+}
+/* Dot products of n pairs of 3D vectors (scalar reference) */
+void dot_v3_batch_ref(const vec3_t *a, const vec3_t *b, f32 *out, u64 n) {
+  for (u64 i = 0; i < n; i++) {
+    out[i] = dot_v3(a[i], b[i]);
+  }
+}
+
+#if defined(MATH3D_X86)
+/* Load 4 packed vec3_t as x, y and z registers */
+__attribute__((target("sse2")))
+static inline void load_v3x4(const vec3_t *v, __m128 *x, __m128 *y,
+                             __m128 *z) {
+  const f32 *p = (const f32 *)v;
+  __m128 a = _mm_loadu_ps(p);     /* x0 y0 z0 x1 */
+  __m128 b = _mm_loadu_ps(p + 4); /* y1 z1 x2 y2 */
+  __m128 c = _mm_loadu_ps(p + 8); /* z2 x3 y3 z3 */
+  *x = _mm_shuffle_ps(
+      _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 0, 0)),
+      _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)),
+      _MM_SHUFFLE(2, 0, 2, 0));
+  *y = _mm_shuffle_ps(
+      _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+      _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)),
+      _MM_SHUFFLE(2, 0, 2, 0));
+  *z = _mm_shuffle_ps(
+      _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+      _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)),
+      _MM_SHUFFLE(2, 0, 2, 0));
+}
+/* Store x, y and z registers as 4 packed vec3_t */
+__attribute__((target("sse2")))
+static inline void store_v3x4(vec3_t *v, __m128 x, __m128 y, __m128 z) {
+  f32 *p = (f32 *)v;
+  _mm_storeu_ps(p, _mm_shuffle_ps(
+      _mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0)),
+      _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)),
+      _MM_SHUFFLE(2, 0, 2, 0)));
+  _mm_storeu_ps(p + 4, _mm_shuffle_ps(
+      _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)),
+      _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)),
+      _MM_SHUFFLE(2, 0, 2, 0)));
+  _mm_storeu_ps(p + 8, _mm_shuffle_ps(
+      _mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)),
+      _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)),
+      _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+/* Multiply n 4D vectors by a 4x4 matrix (SSE, one vector per step) */
+__attribute__((target("sse2")))
+static void mulm4v4_batch_sse(const mat4_t *a, const vec4_t *in, vec4_t *out,
+                              u64 n) {
+  const f32 *m = a->vals;
+  /* Matrix columns */
+  __m128 c0 = _mm_setr_ps(m[0], m[4], m[8], m[12]);
+  __m128 c1 = _mm_setr_ps(m[1], m[5], m[9], m[13]);
+  __m128 c2 = _mm_setr_ps(m[2], m[6], m[10], m[14]);
+  __m128 c3 = _mm_setr_ps(m[3], m[7], m[11], m[15]);
+  for (u64 i = 0; i < n; i++) {
+    __m128 v = _mm_loadu_ps(&in[i].x);
+    __m128 res = _mm_add_ps(
+        _mm_add_ps(
+            _mm_add_ps(
+                _mm_mul_ps(c0, _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0))),
+                _mm_mul_ps(c1, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)))),
+            _mm_mul_ps(c2, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2)))),
+        _mm_mul_ps(c3, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))));
+    _mm_storeu_ps(&out[i].x, res);
+  }
+}
+/* Multiply n 4D vectors by a 4x4 matrix (AVX, two vectors per step) */
+__attribute__((target("avx")))
+static void mulm4v4_batch_avx(const mat4_t *a, const vec4_t *in, vec4_t *out,
+                              u64 n) {
+  const f32 *m = a->vals;
+  /* Matrix columns, repeated in both halves */
+  __m256 c0 = _mm256_setr_ps(
+      m[0], m[4], m[8], m[12], m[0], m[4], m[8], m[12]);
+  __m256 c1 = _mm256_setr_ps(
+      m[1], m[5], m[9], m[13], m[1], m[5], m[9], m[13]);
+  __m256 c2 = _mm256_setr_ps(
+      m[2], m[6], m[10], m[14], m[2], m[6], m[10], m[14]);
+  __m256 c3 = _mm256_setr_ps(
+      m[3], m[7], m[11], m[15], m[3], m[7], m[11], m[15]);
+  u64 i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m256 v = _mm256_loadu_ps(&in[i].x);
+    __m256 res = _mm256_add_ps(
+        _mm256_add_ps(
+            _mm256_add_ps(
+                _mm256_mul_ps(c0,
+                              _mm256_permute_ps(v, _MM_SHUFFLE(0, 0, 0, 0))),
+                _mm256_mul_ps(c1,
+                              _mm256_permute_ps(v, _MM_SHUFFLE(1, 1, 1, 1)))),
+            _mm256_mul_ps(c2, _mm256_permute_ps(v, _MM_SHUFFLE(2, 2, 2, 2)))),
+        _mm256_mul_ps(c3, _mm256_permute_ps(v, _MM_SHUFFLE(3, 3, 3, 3))));
+    _mm256_storeu_ps(&out[i].x, res);
+  }
+  mulm4v4_batch_ref(a, in + i, out + i, n - i);
+}
+/* Multiply n points in x, y, z streams by a 4x4 matrix (SSE, 4 per step) */
+__attribute__((target("sse2")))
+static void mulm4p3_soa_sse(const mat4_t *a, const f32 *x, const f32 *y,
+                            const f32 *z, f32 *out_x, f32 *out_y, f32 *out_z,
+                            f32 *out_w, u64 n) {
+  const f32 *m = a->vals;
+  __m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]);
+  __m128 m2 = _mm_set1_ps(m[2]), m3 = _mm_set1_ps(m[3]);
+  __m128 m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]);
+  __m128 m6 = _mm_set1_ps(m[6]), m7 = _mm_set1_ps(m[7]);
+  __m128 m8 = _mm_set1_ps(m[8]), m9 = _mm_set1_ps(m[9]);
+  __m128 m10 = _mm_set1_ps(m[10]), m11 = _mm_set1_ps(m[11]);
+  __m128 m12 = _mm_set1_ps(m[12]), m13 = _mm_set1_ps(m[13]);
+  __m128 m14 = _mm_set1_ps(m[14]), m15 = _mm_set1_ps(m[15]);
+  u64 i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 px = _mm_loadu_ps(x + i);
+    __m128 py = _mm_loadu_ps(y + i);
+    __m128 pz = _mm_loadu_ps(z + i);
+    _mm_storeu_ps(out_x + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(m0, px), _mm_mul_ps(m1, py)), _mm_mul_ps(m2, pz)), m3));
+    _mm_storeu_ps(out_y + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(m4, px), _mm_mul_ps(m5, py)), _mm_mul_ps(m6, pz)), m7));
+    _mm_storeu_ps(out_z + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(m8, px), _mm_mul_ps(m9, py)), _mm_mul_ps(m10, pz)), m11));
+    _mm_storeu_ps(out_w + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(m12, px), _mm_mul_ps(m13, py)), _mm_mul_ps(m14, pz)), m15));
+  }
+  mulm4p3_soa_ref(a, x + i, y + i, z + i,
+                  out_x + i, out_y + i, out_z + i, out_w + i, n - i);
+}
+/* Multiply n points in x, y, z streams by a 4x4 matrix (AVX, 8 per step) */
+__attribute__((target("avx")))
+static void mulm4p3_soa_avx(const mat4_t *a, const f32 *x, const f32 *y,
+                            const f32 *z, f32 *out_x, f32 *out_y, f32 *out_z,
+                            f32 *out_w, u64 n) {
+  const f32 *m = a->vals;
+  __m256 m0 = _mm256_set1_ps(m[0]), m1 = _mm256_set1_ps(m[1]);
+  __m256 m2 = _mm256_set1_ps(m[2]), m3 = _mm256_set1_ps(m[3]);
+  __m256 m4 = _mm256_set1_ps(m[4]), m5 = _mm256_set1_ps(m[5]);
+  __m256 m6 = _mm256_set1_ps(m[6]), m7 = _mm256_set1_ps(m[7]);
+  __m256 m8 = _mm256_set1_ps(m[8]), m9 = _mm256_set1_ps(m[9]);
+  __m256 m10 = _mm256_set1_ps(m[10]), m11 = _mm256_set1_ps(m[11]);
+  __m256 m12 = _mm256_set1_ps(m[12]), m13 = _mm256_set1_ps(m[13]);
+  __m256 m14 = _mm256_set1_ps(m[14]), m15 = _mm256_set1_ps(m[15]);
+  u64 i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 px = _mm256_loadu_ps(x + i);
+    __m256 py = _mm256_loadu_ps(y + i);
+    __m256 pz = _mm256_loadu_ps(z + i);
+    _mm256_storeu_ps(out_x + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+        _mm256_mul_ps(m0, px), _mm256_mul_ps(m1, py)),
+        _mm256_mul_ps(m2, pz)), m3));
+    _mm256_storeu_ps(out_y + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+        _mm256_mul_ps(m4, px), _mm256_mul_ps(m5, py)),
+        _mm256_mul_ps(m6, pz)), m7));
+    _mm256_storeu_ps(out_z + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+        _mm256_mul_ps(m8, px), _mm256_mul_ps(m9, py)),
+        _mm256_mul_ps(m10, pz)), m11));
+    _mm256_storeu_ps(out_w + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+        _mm256_mul_ps(m12, px), _mm256_mul_ps(m13, py)),
+        _mm256_mul_ps(m14, pz)), m15));
+  }
+  mulm4p3_soa_sse(a, x + i, y + i, z + i,
+                  out_x + i, out_y + i, out_z + i, out_w + i, n - i);
+}
+/* Normalize n 3D vectors (SSE, 4 per step) */
+__attribute__((target("sse2")))
+static void normalize_v3_batch_sse(const vec3_t *in, vec3_t *out, u64 n) {
+  u64 i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 x, y, z;
+    load_v3x4(in + i, &x, &y, &z);
+    __m128 len = _mm_sqrt_ps(_mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+    store_v3x4(out + i,
+               _mm_div_ps(x, len), _mm_div_ps(y, len), _mm_div_ps(z, len));
+  }
+  normalize_v3_batch_ref(in + i, out + i, n - i);
+}
+/* Cross products of n pairs of 3D vectors (SSE, 4 per step) */
+__attribute__((target("sse2")))
+static void cross_v3_batch_sse(const vec3_t *a, const vec3_t *b, vec3_t *out,
+                               u64 n) {
+  u64 i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 ax, ay, az, bx, by, bz;
+    load_v3x4(a + i, &ax, &ay, &az);
+    load_v3x4(b + i, &bx, &by, &bz);
+    store_v3x4(out + i,
+               _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by)),
+               _mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz)),
+               _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx)));
+  }
+  cross_v3_batch_ref(a + i, b + i, out + i, n - i);
+}
+/* Dot products of n pairs of 3D vectors (SSE, 4 per step) */
+__attribute__((target("sse2")))
+static void dot_v3_batch_sse(const vec3_t *a, const vec3_t *b, f32 *out,
+                             u64 n) {
+  u64 i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 ax, ay, az, bx, by, bz;
+    load_v3x4(a + i, &ax, &ay, &az);
+    load_v3x4(b + i, &bx, &by, &bz);
+    _mm_storeu_ps(out + i, _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+        _mm_mul_ps(az, bz)));
+  }
+  dot_v3_batch_ref(a + i, b + i, out + i, n - i);
+}
+#endif /* MATH3D_X86 */
+
+/* Instruction sets usable for the batch operations */
+typedef enum {
+  SIMD_UNKNOWN,
+  SIMD_NONE,
+  SIMD_SSE,
+  SIMD_AVX,
+} simd_level_t;
+/* Find out (once) which instruction sets the CPU has */
+static simd_level_t simd_level(void) {
+  static simd_level_t level = SIMD_UNKNOWN;
+  if (level == SIMD_UNKNOWN) {
+#if defined(MATH3D_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+      level = SIMD_AVX;
+    else if (__builtin_cpu_supports("sse2"))
+      level = SIMD_SSE;
+    else
+      level = SIMD_NONE;
+#else
+    level = SIMD_NONE;
+#endif
+  }
+  return level;
+}
+
+/* Multiply n 4D vectors by a 4x4 matrix */
+void mulm4v4_batch(const mat4_t *a, const vec4_t *in, vec4_t *out, u64 n) {
+#if defined(MATH3D_X86)
+  switch (simd_level()) {
+  case SIMD_AVX:
+    mulm4v4_batch_avx(a, in, out, n);
+    return;
+  case SIMD_SSE:
+    mulm4v4_batch_sse(a, in, out, n);
+    return;
+  default:
+    break;
+  }
+#endif
+  mulm4v4_batch_ref(a, in, out, n);
+}
+/* Multiply n points (w = 1) in x, y, z streams by a 4x4 matrix */
+void mulm4p3_soa(const mat4_t *a, const f32 *x, const f32 *y, const f32 *z,
+                 f32 *out_x, f32 *out_y, f32 *out_z, f32 *out_w, u64 n) {
+#if defined(MATH3D_X86)
+  switch (simd_level()) {
+  case SIMD_AVX:
+    mulm4p3_soa_avx(a, x, y, z, out_x, out_y, out_z, out_w, n);
+    return;
+  case SIMD_SSE:
+    mulm4p3_soa_sse(a, x, y, z, out_x, out_y, out_z, out_w, n);
+    return;
+  default:
+    break;
+  }
+#endif
+  mulm4p3_soa_ref(a, x, y, z, out_x, out_y, out_z, out_w, n);
+}
+/* Normalize n 3D vectors */
+void normalize_v3_batch(const vec3_t *in, vec3_t *out, u64 n) {
+#if defined(MATH3D_X86)
+  if (simd_level() >= SIMD_SSE) {
+    normalize_v3_batch_sse(in, out, n);
+    return;
+  }
+#endif
+  normalize_v3_batch_ref(in, out, n);
+}
+/* Cross products of n pairs of 3D vectors */
+void cross_v3_batch(const vec3_t *a, const vec3_t *b, vec3_t *out, u64 n) {
+#if defined(MATH3D_X86)
+  if (simd_level() >= SIMD_SSE) {
+    cross_v3_batch_sse(a, b, out, n);
+    return;
+  }
+#endif
+  cross_v3_batch_ref(a, b, out, n);
+}
+/* Dot products of n pairs of 3D vectors */
+void dot_v3_batch(const vec3_t *a, const vec3_t *b, f32 *out, u64 n) {
+#if defined(MATH3D_X86)
+  if (simd_level() >= SIMD_SSE) {
+    dot_v3_batch_sse(a, b, out, n);
+    return;
+  }
+#endif
+  dot_v3_batch_ref(a, b, out, n);
+}
+
 /* Create a perspective projection matrix */
 mat4_t projection(f32 fov, f32 aspect, f32 near_z, f32 far_z) {
   mat4_t res;
@@ -205,8 +544,8 @@ mat4_t projection(f32 fov, f32 aspect, f32 near_z, f32 far_z) {
   res.vals[0] = aspect * projection_a;
   res.vals[5] = projection_a;
   res.vals[10] = projection_b;
-  res.vals[11] = 1.0;
-  res.vals[14] = projection_b * (-near_z);
+  res.vals[11] = projection_b * (-near_z);
+  res.vals[14] = 1.0;
   res.vals[15] = 0.0;
   return res;
 }
@@ -58,13 +58,6 @@ typedef struct {
 typedef struct {
   col_t c0, c1, c2;
 } tri_col_t;
-/* The type of a 3D mesh */
-typedef struct {
-  tri_t* tris;
-  tri_col_t* cols;
-  u64 tri_count;
-  vec3_t pos;
-} mesh_t;
 
 /* Macros */
 /* Convert easily from vector types with more dimensions */
@@ -109,7 +102,37 @@ mat4_t mulm4(mat4_t a, mat4_t b);
 /* Multiply a 4x4 matrix by a 4D vector */
 vec4_t mulm4v4(mat4_t a, vec4_t b);
 
-/* Create a perspective projection matrix */
+/*
+ * Batch operations: each call processes n elements, keeping the matrix in
+ * registers across the whole batch. They use SSE or AVX kernels picked at
+ * runtime where the CPU has them, and give the same results as the scalar
+ * reference versions (suffixed _ref) up to rounding.
+ */
+/* Multiply n 4D vectors by a 4x4 matrix */
+void mulm4v4_batch(const mat4_t *a, const vec4_t *in, vec4_t *out, u64 n);
+/* Multiply n points (w = 1) in x, y, z streams by a 4x4 matrix */
+void mulm4p3_soa(const mat4_t *a, const f32 *x, const f32 *y, const f32 *z,
+                 f32 *out_x, f32 *out_y, f32 *out_z, f32 *out_w, u64 n);
+/* Normalize n 3D vectors */
+void normalize_v3_batch(const vec3_t *in, vec3_t *out, u64 n);
+/* Cross products of n pairs of 3D vectors */
+void cross_v3_batch(const vec3_t *a, const vec3_t *b, vec3_t *out, u64 n);
+/* Dot products of n pairs of 3D vectors */
+void dot_v3_batch(const vec3_t *a, const vec3_t *b, f32 *out, u64 n);
+
+/* Scalar reference versions of the batch operations */
+void mulm4v4_batch_ref(const mat4_t *a, const vec4_t *in, vec4_t *out, u64 n);
+void mulm4p3_soa_ref(const mat4_t *a, const f32 *x, const f32 *y,
+                     const f32 *z, f32 *out_x, f32 *out_y, f32 *out_z,
+                     f32 *out_w, u64 n);
+void normalize_v3_batch_ref(const vec3_t *in, vec3_t *out, u64 n);
+void cross_v3_batch_ref(const vec3_t *a, const vec3_t *b, vec3_t *out, u64 n);
+void dot_v3_batch_ref(const vec3_t *a, const vec3_t *b, f32 *out, u64 n);
+
+/*
+ * Create a perspective projection matrix. Clip space w is the view depth,
+ * and z / w runs from 0 at near_z to 1 at far_z.
+ */
 mat4_t projection(f32 fov, f32 aspect, f32 near_z, f32 far_z);
 /* Create a 4x4 3D translation matrix */
 mat4_t translation(vec3_t v);
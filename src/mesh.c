@@ -0,0 +1,545 @@
+/* Implements mesh.h */
+#include "mesh.h"
+
+/* C Stdlib headers */
+#include <math.h>   /* sqrtf() */
+#include <stdio.h>  /* File I/O */
+#include <stdlib.h> /* malloc(), realloc(), free(), strtof(), strtol() */
+#include <string.h> /* memcpy(), memset(), memcmp(), strcspn() */
+
+/* Memory mapped files, where available */
+#if defined(__unix__) || defined(__APPLE__)
+#define MESH_MMAP
+#include <fcntl.h>    /* open() */
+#include <sys/mman.h> /* mmap(), munmap() */
+#include <sys/stat.h> /* fstat() */
+#include <unistd.h>   /* close() */
+#endif
+
+/* Get the position of a vertex of a mesh */
+vec3_t mesh_vert(const mesh_t *mesh, u32 index) {
+  return (vec3_t){mesh->x[index], mesh->y[index], mesh->z[index]};
+}
+/* Get the corners of a triangle of a mesh */
+tri_t mesh_tri(const mesh_t *mesh, u32 index) {
+  const u32 *corners = mesh->indices + (3 * index);
+  tri_t res;
+  res.v0 = mesh_vert(mesh, corners[0]);
+  res.v1 = mesh_vert(mesh, corners[1]);
+  res.v2 = mesh_vert(mesh, corners[2]);
+  return res;
+}
+/* Get the corner colours of a triangle of a mesh */
+tri_col_t mesh_tri_cols(const mesh_t *mesh, u32 index) {
+  const u32 *corners = mesh->indices + (3 * index);
+  tri_col_t res;
+  res.c0 = mesh->cols[corners[0]];
+  res.c1 = mesh->cols[corners[1]];
+  res.c2 = mesh->cols[corners[2]];
+  return res;
+}
+/* Recompute the bounds of a mesh, after its vertices change */
+void mesh_compute_bounds(mesh_t *mesh) {
+  bounds_t *bounds = &mesh->bounds;
+  if (mesh->vert_count == 0) {
+    memset(bounds, 0, sizeof(*bounds));
+    return;
+  }
+  bounds->min = bounds->max = mesh_vert(mesh, 0);
+  for (u32 i = 1; i < mesh->vert_count; i++) {
+    f32 x = mesh->x[i], y = mesh->y[i], z = mesh->z[i];
+    bounds->min = (vec3_t){
+        MIN(bounds->min.x, x), MIN(bounds->min.y, y), MIN(bounds->min.z, z),
+    };
+    bounds->max = (vec3_t){
+        MAX(bounds->max.x, x), MAX(bounds->max.y, y), MAX(bounds->max.z, z),
+    };
+  }
+  bounds->center = (vec3_t){
+      0.5f * (bounds->min.x + bounds->max.x),
+      0.5f * (bounds->min.y + bounds->max.y),
+      0.5f * (bounds->min.z + bounds->max.z),
+  };
+  /* The farthest vertex from the centre sets the radius */
+  f32 max_dist2 = 0.0f;
+  for (u32 i = 0; i < mesh->vert_count; i++) {
+    f32 dx = mesh->x[i] - bounds->center.x;
+    f32 dy = mesh->y[i] - bounds->center.y;
+    f32 dz = mesh->z[i] - bounds->center.z;
+    max_dist2 = MAX(max_dist2, dx * dx + dy * dy + dz * dz);
+  }
+  bounds->radius = sqrtf(max_dist2);
+}
+
+/* Round a file offset up to the stream alignment */
+static u64 align_offset(u64 offset) {
+  return (offset + MESH_FILE_ALIGN - 1) & ~(u64)(MESH_FILE_ALIGN - 1);
+}
+/* Lay out a mesh file for a number of vertices and triangles */
+static void layout_file(mesh_file_header_t *header, u32 verts, u32 tris,
+                        bool has_uvs) {
+  memset(header, 0, sizeof(*header));
+  header->magic = MESH_FILE_MAGIC;
+  header->version = MESH_FILE_VERSION;
+  header->vert_count = verts;
+  header->tri_count = tris;
+  u64 offset = align_offset(sizeof(*header));
+  header->x_offset = offset;
+  offset = align_offset(offset + sizeof(f32) * (u64)verts);
+  header->y_offset = offset;
+  offset = align_offset(offset + sizeof(f32) * (u64)verts);
+  header->z_offset = offset;
+  offset = align_offset(offset + sizeof(f32) * (u64)verts);
+  header->cols_offset = offset;
+  offset = align_offset(offset + sizeof(col_t) * (u64)verts);
+  if (has_uvs) {
+    header->u_offset = offset;
+    offset = align_offset(offset + sizeof(f32) * (u64)verts);
+    header->v_offset = offset;
+    offset = align_offset(offset + sizeof(f32) * (u64)verts);
+  }
+  header->indices_offset = offset;
+  header->size = align_offset(offset + sizeof(u32) * 3 * (u64)tris);
+}
+/*
+ * Check a mesh file, starting with its header, against the size of the
+ * file, and that every index in it names one of its vertices
+ */
+static bool check_header(const mesh_file_header_t *header, u64 size) {
+  if (header->magic != MESH_FILE_MAGIC
+      || header->version != MESH_FILE_VERSION)
+    return false;
+  /* Files are only ever written with the canonical layout */
+  mesh_file_header_t expect;
+  layout_file(&expect, header->vert_count, header->tri_count,
+              header->u_offset != 0);
+  if (memcmp(header, &expect, sizeof(expect)) != 0 || header->size > size)
+    return false;
+  /* Checked once here, so drawing never reads past the vertex streams */
+  const u32 *indices =
+      (const u32 *)((const u8 *)header + header->indices_offset);
+  for (u64 i = 0; i < 3 * (u64)header->tri_count; i++) {
+    if (indices[i] >= header->vert_count)
+      return false;
+  }
+  return true;
+}
+/* Point a mesh's streams into memory laid out as a mesh file */
+static void bind_streams(mesh_t *mesh, u8 *data,
+                         const mesh_file_header_t *header) {
+  mesh->x = (f32 *)(data + header->x_offset);
+  mesh->y = (f32 *)(data + header->y_offset);
+  mesh->z = (f32 *)(data + header->z_offset);
+  mesh->cols = (col_t *)(data + header->cols_offset);
+  mesh->u = header->u_offset ? (f32 *)(data + header->u_offset) : NULL;
+  mesh->v = header->v_offset ? (f32 *)(data + header->v_offset) : NULL;
+  mesh->indices = (u32 *)(data + header->indices_offset);
+  mesh->vert_count = header->vert_count;
+  mesh->tri_count = header->tri_count;
+  mesh->data = data;
+  mesh->data_size = header->size;
+}
+/* Read a whole file into memory, NUL terminated */
+static char *read_file(const char *path, u64 *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return NULL;
+  char *data = NULL;
+  if (fseek(file, 0, SEEK_END) == 0) {
+    long len = ftell(file);
+    if (len >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+      data = malloc(len + 1);
+      if (data && fread(data, 1, len, file) == (size_t)len) {
+        data[len] = '\0';
+        *size = len;
+      } else {
+        free(data);
+        data = NULL;
+      }
+    }
+  }
+  fclose(file);
+  return data;
+}
+
+/* Load a mesh from a binary mesh file or, failing that, an OBJ file */
+bool mesh_load(const char *path, mesh_t *mesh) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return false;
+  u32 magic = 0;
+  bool is_binary = fread(&magic, sizeof(magic), 1, file) == 1
+      && magic == MESH_FILE_MAGIC;
+  fclose(file);
+  return is_binary ? mesh_map(path, mesh) : mesh_load_obj(path, mesh);
+}
+/* Map a binary mesh file read-only */
+bool mesh_map(const char *path, mesh_t *mesh) {
+  memset(mesh, 0, sizeof(*mesh));
+#if defined(MESH_MMAP)
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (u64)info.st_size < sizeof(mesh_file_header_t)) {
+    close(fd);
+    return false;
+  }
+  u64 size = info.st_size;
+  void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+  if (!check_header(data, size)) {
+    munmap(data, size);
+    return false;
+  }
+  bind_streams(mesh, data, data);
+  mesh->data_size = size;
+  mesh->mapped = true;
+  mesh_compute_bounds(mesh);
+  return true;
+#else
+  /* No mmap, read the file in instead */
+  u64 size = 0;
+  char *data = read_file(path, &size);
+  if (!data)
+    return false;
+  if (size < sizeof(mesh_file_header_t) || !check_header((void *)data, size)) {
+    free(data);
+    return false;
+  }
+  bind_streams(mesh, (u8 *)data, (mesh_file_header_t *)data);
+  mesh_compute_bounds(mesh);
+  return true;
+#endif
+}
+/*
+ * Give each distinct pair of position and texture coordinate index used by
+ * the corners of an OBJ file's triangles a vertex of its own. Rewrites
+ * indices to refer to the new vertices, and returns the pair each came
+ * from in sources, two per vertex. Returns false if out of memory.
+ */
+static bool split_uv_verts(u32 *indices, const u32 *uv_indices, u64 count,
+                           u32 **sources, u64 *vert_count) {
+  /* Open addressed hash table from a pair to its vertex, half full at most */
+  u64 capacity = 16;
+  while (capacity < 2 * count)
+    capacity *= 2;
+  u64 *keys = malloc(sizeof(u64) * capacity);
+  u32 *verts = malloc(sizeof(u32) * capacity);
+  *sources = malloc(sizeof(u32) * 2 * MAX(count, 1));
+  if (!keys || !verts || !*sources) {
+    free(keys);
+    free(verts);
+    return false;
+  }
+  memset(keys, 0xff, sizeof(u64) * capacity);
+  u64 out_count = 0;
+  for (u64 i = 0; i < count; i++) {
+    u64 key = ((u64)indices[i] << 32) | uv_indices[i];
+    u64 slot = (key * 0x9e3779b97f4a7c15ull) >> 32;
+    while (true) {
+      slot &= capacity - 1;
+      if (keys[slot] == key)
+        break;
+      if (keys[slot] == UINT64_MAX) {
+        keys[slot] = key;
+        verts[slot] = out_count;
+        (*sources)[2 * out_count] = indices[i];
+        (*sources)[(2 * out_count) + 1] = uv_indices[i];
+        out_count++;
+        break;
+      }
+      slot++;
+    }
+    indices[i] = verts[slot];
+  }
+  free(keys);
+  free(verts);
+  *vert_count = out_count;
+  return true;
+}
+/* Parse a Wavefront OBJ file */
+bool mesh_load_obj(const char *path, mesh_t *mesh) {
+  memset(mesh, 0, sizeof(*mesh));
+  u64 size = 0;
+  char *text = read_file(path, &size);
+  if (!text)
+    return false;
+
+  /*
+   * Gather positions, colours, texture coordinates and triangles into
+   * growable arrays. Each corner of a triangle has a position index and a
+   * texture coordinate index, UINT32_MAX if it has none.
+   */
+  f32 *pos = NULL;
+  col_t *cols = NULL;
+  bool has_cols = false;
+  f32 *uvs = NULL;
+  bool has_uvs = false;
+  u32 *indices = NULL, *uv_indices = NULL;
+  u64 vert_count = 0, vert_capacity = 0;
+  u64 uv_count = 0, uv_capacity = 0;
+  u64 index_count = 0, index_capacity = 0;
+  bool ok = true;
+  char *line = text;
+  while (ok && *line) {
+    char *end = line + strcspn(line, "\n");
+    char *next = *end ? end + 1 : end;
+    *end = '\0';
+    if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t')) {
+      /* Vertex: x y z, optionally followed by r g b from 0 to 1 */
+      if (vert_count == vert_capacity) {
+        vert_capacity = MAX(vert_capacity * 2, 1024);
+        /* Keep the old arrays on failure, so they are still freed */
+        f32 *new_pos = realloc(pos, sizeof(f32) * 3 * vert_capacity);
+        if (new_pos)
+          pos = new_pos;
+        col_t *new_cols = realloc(cols, sizeof(col_t) * vert_capacity);
+        if (new_cols)
+          cols = new_cols;
+        if (!new_pos || !new_cols) {
+          ok = false;
+          break;
+        }
+      }
+      char *p = line + 2;
+      f32 vals[6];
+      u32 count = 0;
+      while (count < 6) {
+        char *num_end;
+        vals[count] = strtof(p, &num_end);
+        if (num_end == p)
+          break;
+        p = num_end;
+        count++;
+      }
+      if (count < 3) {
+        ok = false;
+        break;
+      }
+      memcpy(pos + (3 * vert_count), vals, sizeof(f32) * 3);
+      if (count == 6) {
+        has_cols = true;
+        cols[vert_count] = (col_t){
+            255 * MIN(MAX(vals[3], 0.0f), 1.0f),
+            255 * MIN(MAX(vals[4], 0.0f), 1.0f),
+            255 * MIN(MAX(vals[5], 0.0f), 1.0f),
+            0xff,
+        };
+      } else {
+        cols[vert_count] = (col_t){0xff, 0xff, 0xff, 0xff};
+      }
+      vert_count++;
+    } else if (line[0] == 'v' && line[1] == 't'
+               && (line[2] == ' ' || line[2] == '\t')) {
+      /* Texture coordinate: u v, and an optional w that is ignored */
+      if (uv_count == uv_capacity) {
+        uv_capacity = MAX(uv_capacity * 2, 1024);
+        f32 *new_uvs = realloc(uvs, sizeof(f32) * 2 * uv_capacity);
+        if (!new_uvs) {
+          ok = false;
+          break;
+        }
+        uvs = new_uvs;
+      }
+      char *p = line + 3, *num_end;
+      f32 u = strtof(p, &num_end);
+      if (num_end == p) {
+        ok = false;
+        break;
+      }
+      p = num_end;
+      f32 v = strtof(p, &num_end);
+      uvs[2 * uv_count] = u;
+      uvs[(2 * uv_count) + 1] = num_end == p ? 1.0f : 1.0f - v;
+      uv_count++;
+    } else if (line[0] == 'f' && (line[1] == ' ' || line[1] == '\t')) {
+      /* Face: v, v/vt, v//vn or v/vt/vn corners, split into a fan */
+      char *p = line + 2;
+      u32 corners = 0, first = 0, prev = 0;
+      u32 first_uv = UINT32_MAX, prev_uv = UINT32_MAX;
+      while (true) {
+        char *num_end;
+        long index = strtol(p, &num_end, 10);
+        if (num_end == p)
+          break;
+        /* Negative indices count back from the latest vertex */
+        if (index < 0)
+          index += vert_count + 1;
+        if (index < 1 || (u64)index > vert_count) {
+          ok = false;
+          break;
+        }
+        u32 vert = index - 1;
+        u32 uv = UINT32_MAX;
+        if (num_end[0] == '/' && num_end[1] != '/') {
+          char *uv_start = num_end + 1;
+          long uv_index = strtol(uv_start, &num_end, 10);
+          if (uv_index < 0)
+            uv_index += uv_count + 1;
+          if (num_end == uv_start || uv_index < 1
+              || (u64)uv_index > uv_count) {
+            ok = false;
+            break;
+          }
+          uv = uv_index - 1;
+          has_uvs = true;
+        }
+        p = num_end + strcspn(num_end, " \t\r");
+        if (corners >= 2) {
+          if (index_count + 3 > index_capacity) {
+            index_capacity = MAX(index_capacity * 2, 3072);
+            u32 *new_indices = realloc(indices, sizeof(u32) * index_capacity);
+            if (new_indices)
+              indices = new_indices;
+            u32 *new_uv_indices =
+                realloc(uv_indices, sizeof(u32) * index_capacity);
+            if (new_uv_indices)
+              uv_indices = new_uv_indices;
+            if (!new_indices || !new_uv_indices) {
+              ok = false;
+              break;
+            }
+          }
+          uv_indices[index_count] = first_uv;
+          indices[index_count++] = first;
+          uv_indices[index_count] = prev_uv;
+          indices[index_count++] = prev;
+          uv_indices[index_count] = uv;
+          indices[index_count++] = vert;
+        }
+        if (corners == 0) {
+          first = vert;
+          first_uv = uv;
+        }
+        prev = vert;
+        prev_uv = uv;
+        corners++;
+      }
+    }
+    /* Everything else (normals, groups, materials...) is skipped */
+    line = next;
+  }
+  free(text);
+
+  /*
+   * With texture coordinates, each pair of position and texture
+   * coordinate used becomes a vertex; sources maps them back
+   */
+  u32 *sources = NULL;
+  u64 out_count = vert_count;
+  if (ok && has_uvs && !split_uv_verts(indices, uv_indices, index_count,
+                                       &sources, &out_count))
+    ok = false;
+  if (!ok || out_count > UINT32_MAX || index_count / 3 > UINT32_MAX) {
+    free(pos);
+    free(cols);
+    free(uvs);
+    free(indices);
+    free(uv_indices);
+    free(sources);
+    return false;
+  }
+
+  /* Colour by place in the bounding box where the file had no colours */
+  if (!has_cols && vert_count > 0) {
+    vec3_t lo = {pos[0], pos[1], pos[2]}, hi = lo;
+    for (u64 i = 0; i < vert_count; i++) {
+      const f32 *v = pos + (3 * i);
+      lo = (vec3_t){MIN(lo.x, v[0]), MIN(lo.y, v[1]), MIN(lo.z, v[2])};
+      hi = (vec3_t){MAX(hi.x, v[0]), MAX(hi.y, v[1]), MAX(hi.z, v[2])};
+    }
+    vec3_t scale = {
+        hi.x > lo.x ? 255 / (hi.x - lo.x) : 0,
+        hi.y > lo.y ? 255 / (hi.y - lo.y) : 0,
+        hi.z > lo.z ? 255 / (hi.z - lo.z) : 0,
+    };
+    for (u64 i = 0; i < vert_count; i++) {
+      const f32 *v = pos + (3 * i);
+      cols[i] = (col_t){
+          (v[0] - lo.x) * scale.x, (v[1] - lo.y) * scale.y,
+          (v[2] - lo.z) * scale.z, 0xff,
+      };
+    }
+  }
+
+  /* Move everything into one block laid out like a mesh file */
+  mesh_file_header_t header;
+  layout_file(&header, out_count, index_count / 3, has_uvs);
+  u8 *data = calloc(1, header.size);
+  if (data) {
+    memcpy(data, &header, sizeof(header));
+    bind_streams(mesh, data, &header);
+    for (u64 i = 0; i < out_count; i++) {
+      u64 src = has_uvs ? sources[2 * i] : i;
+      mesh->x[i] = pos[3 * src];
+      mesh->y[i] = pos[(3 * src) + 1];
+      mesh->z[i] = pos[(3 * src) + 2];
+      mesh->cols[i] = cols[src];
+      if (has_uvs) {
+        u32 uv = sources[(2 * i) + 1];
+        mesh->u[i] = uv == UINT32_MAX ? 0.0f : uvs[2 * uv];
+        mesh->v[i] = uv == UINT32_MAX ? 0.0f : uvs[(2 * uv) + 1];
+      }
+    }
+    memcpy(mesh->indices, indices, sizeof(u32) * index_count);
+    mesh_compute_bounds(mesh);
+  }
+  free(pos);
+  free(cols);
+  free(uvs);
+  free(indices);
+  free(uv_indices);
+  free(sources);
+  return data != NULL;
+}
+/* Write a stream at an offset in a file, padding up to it with zeros */
+static bool write_stream(FILE *file, u64 *at, u64 offset, const void *data,
+                         u64 size) {
+  static const u8 zeros[MESH_FILE_ALIGN];
+  if (offset - *at > sizeof(zeros)
+      || fwrite(zeros, 1, offset - *at, file) != offset - *at
+      || (size > 0 && fwrite(data, 1, size, file) != size))
+    return false;
+  *at = offset + size;
+  return true;
+}
+/* Write a mesh as a binary mesh file */
+bool mesh_save(const char *path, const mesh_t *mesh) {
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return false;
+  mesh_file_header_t header;
+  bool has_uvs = mesh->u && mesh->v;
+  layout_file(&header, mesh->vert_count, mesh->tri_count, has_uvs);
+  u64 verts = mesh->vert_count, at = 0;
+  bool ok = write_stream(file, &at, 0, &header, sizeof(header))
+      && write_stream(file, &at, header.x_offset, mesh->x, sizeof(f32) * verts)
+      && write_stream(file, &at, header.y_offset, mesh->y, sizeof(f32) * verts)
+      && write_stream(file, &at, header.z_offset, mesh->z, sizeof(f32) * verts)
+      && write_stream(file, &at, header.cols_offset, mesh->cols,
+                      sizeof(col_t) * verts)
+      && (!has_uvs
+          || (write_stream(file, &at, header.u_offset, mesh->u,
+                           sizeof(f32) * verts)
+              && write_stream(file, &at, header.v_offset, mesh->v,
+                              sizeof(f32) * verts)))
+      && write_stream(file, &at, header.indices_offset, mesh->indices,
+                      sizeof(u32) * 3 * (u64)mesh->tri_count)
+      && write_stream(file, &at, header.size, NULL, 0);
+  return fclose(file) == 0 && ok;
+}
+/* Free or unmap a loaded mesh */
+void mesh_free(mesh_t *mesh) {
+#if defined(MESH_MMAP)
+  if (mesh->mapped)
+    munmap(mesh->data, mesh->data_size);
+  else
+    free(mesh->data);
+#else
+  free(mesh->data);
+#endif
+  memset(mesh, 0, sizeof(*mesh));
+}
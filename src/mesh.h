@@ -0,0 +1,98 @@
+/* Include guard */
+#if !defined(MESH_H)
+#define MESH_H
+
+/* C Stdlib headers */
+#include <stdbool.h> /* For boolean type */
+
+/* Project headers */
+#include "math3d.h" /* Vector types */
+
+/* Consts */
+#define MESH_FILE_MAGIC   0x48534d52 /* "RMSH" read as a little endian u32 */
+#define MESH_FILE_VERSION 2
+#define MESH_FILE_ALIGN   64 /* Alignment of each stream in a mesh file */
+
+/* Bounding volumes of a mesh in object space */
+typedef struct {
+  vec3_t min, max; /* Axis aligned box */
+  vec3_t center;   /* Sphere, centred on the box */
+  f32 radius;
+} bounds_t;
+
+/*
+ * The type of an indexed 3D mesh. Each vertex attribute is its own stream
+ * (structure of arrays) of vert_count entries, and every triangle is three
+ * 32-bit indices into the streams, so shared vertices are stored and
+ * transformed once. A mesh is only geometry, in object space; it is placed
+ * in the world by the instances it is drawn with.
+ */
+typedef struct {
+  /* Vertex streams */
+  f32 *x, *y, *z;
+  col_t *cols;
+  f32 *u, *v; /* Texture coordinates, or NULL if the mesh has none */
+  u32 vert_count;
+  /* Index buffer, three per triangle */
+  u32 *indices;
+  u32 tri_count;
+  /* Bounds of the vertices, see mesh_compute_bounds() */
+  bounds_t bounds;
+  /*
+   * Memory holding the streams of a loaded mesh, laid out as a mesh file,
+   * or NULL when the streams belong to someone else
+   */
+  void *data;
+  u64 data_size;
+  bool mapped; /* Whether data is a read-only file mapping */
+} mesh_t;
+
+/*
+ * Header of a binary mesh file. The streams follow it in the order x, y, z,
+ * cols, u, v, indices, each at a MESH_FILE_ALIGN aligned offset from the
+ * start of the file, in native byte order. The u and v streams are left out
+ * of meshes with no texture coordinates, and their offsets are 0. A file
+ * can be mapped and its streams used in place, with no parsing or copying.
+ */
+typedef struct {
+  u32 magic;
+  u32 version;
+  u32 vert_count;
+  u32 tri_count;
+  u64 x_offset, y_offset, z_offset, cols_offset, u_offset, v_offset;
+  u64 indices_offset;
+  u64 size; /* Size of the whole file */
+} mesh_file_header_t;
+
+/* Get the position of a vertex of a mesh */
+vec3_t mesh_vert(const mesh_t *mesh, u32 index);
+/* Get the corners of a triangle of a mesh */
+tri_t mesh_tri(const mesh_t *mesh, u32 index);
+/* Get the corner colours of a triangle of a mesh */
+tri_col_t mesh_tri_cols(const mesh_t *mesh, u32 index);
+/* Recompute the bounds of a mesh, after its vertices change */
+void mesh_compute_bounds(mesh_t *mesh);
+
+/*
+ * Load a mesh from a binary mesh file or, failing that, a Wavefront OBJ
+ * file. Binary files are mapped read-only. The loaders compute the mesh's
+ * bounds. Returns false on error.
+ */
+bool mesh_load(const char *path, mesh_t *mesh);
+/* Map a binary mesh file read-only, returns false on error */
+bool mesh_map(const char *path, mesh_t *mesh);
+/*
+ * Parse a Wavefront OBJ file. Faces are split into triangle fans. Vertex
+ * colours are taken from "v x y z r g b" lines where present; otherwise
+ * vertices are coloured by their place in the bounding box, so shapes read
+ * without lighting. If faces have texture coordinates, a vertex is made
+ * for each pair of position and texture coordinate used, with v flipped so
+ * 0 is the top of the texture. Returns false on error.
+ */
+bool mesh_load_obj(const char *path, mesh_t *mesh);
+/* Write a mesh as a binary mesh file, returns false on error */
+bool mesh_save(const char *path, const mesh_t *mesh);
+/* Free or unmap a loaded mesh */
+void mesh_free(mesh_t *mesh);
+
+#endif /* MESH_H */
@@ -0,0 +1,494 @@
+/* Implements pipeline.h */
+#include "pipeline.h"
+
+/* C Stdlib headers */
+#include <stdlib.h> /* realloc(), free() */
+#include <string.h> /* memcpy() */
+
+/* Project headers */
+#include "arena.h"    /* Transient allocations */
+#include "profiler.h" /* Stage timers and counters */
+#include "tiles.h"    /* Tiled rasterizer */
+
+/* Most vertices a triangle can have after clipping */
+#define CLIP_MAX_VERTS (3 + CLIP_PLANES)
+
+/* Outcode bits, one per clip plane */
+enum {
+  CLIP_NEAR = 1 << 0,   /* z >= 0 */
+  CLIP_FAR = 1 << 1,    /* z <= w */
+  CLIP_LEFT = 1 << 2,   /* x >= -w */
+  CLIP_RIGHT = 1 << 3,  /* x <= w */
+  CLIP_BOTTOM = 1 << 4, /* y >= -w */
+  CLIP_TOP = 1 << 5,    /* y <= w */
+};
+
+/* An entry of the post-transform cache */
+typedef struct {
+  u32 index;     /* Vertex index, UINT32_MAX when empty */
+  u8 view_code;  /* Planes of the view volume the vertex is outside of */
+  u8 clip_code;  /* Planes of the guard band volume it is outside of */
+  vec3_t pos;    /* Screen space position, set when clip_code is 0 */
+  f32 q;         /* 1/w, set with pos when drawing textured */
+} cache_entry_t;
+
+/* A vertex being clipped */
+typedef struct {
+  vec4_t pos; /* Clip space position */
+  vec4_t col; /* Colour, as floats so it can be interpolated */
+  vec2_t uv;  /* Texture coordinates, when drawing textured */
+} clip_vert_t;
+
+/* Screen space triangles waiting to be culled and set up together */
+typedef struct {
+  tri_t tris[CULL_BATCH];
+  tri_col_t cols[CULL_BATCH];
+  tri_tex_t texs[CULL_BATCH]; /* Set when drawing textured */
+  u32 count;
+  u32 back_facing, empty; /* Triangles culled, since last counted */
+} setup_batch_t;
+
+/* The wireframe overlay of a frame, drawn once its tiles are filled */
+typedef struct {
+  target_t target;
+  tri_t *tris;
+  u64 count, capacity;
+} overlay_t;
+
+/* Pipeline state */
+static struct {
+  target_t target;
+  mat4_t view_proj;
+  /* Extent of the guard band in NDC, 1 being the edge of the target */
+  f32 guard_x, guard_y;
+  /* Transient memory of the frame being drawn */
+  arena_t arena;
+  /* Clip space vertex buffer of the mesh being drawn, one stream each */
+  f32 *clip_x, *clip_y, *clip_z, *clip_w;
+  /* Texture and texture coordinates of the instance, NULL if untextured */
+  const texture_t *texture;
+  const f32 *u, *v;
+  /* Post-transform cache */
+  cache_entry_t cache[VERTEX_CACHE_SIZE];
+  /* Screen space triangles of the instance not yet set up */
+  setup_batch_t batch;
+  /*
+   * Wireframe overlays: one for the frame being drawn, and one for a frame
+   * handed off by pipeline_submit() that is still being rasterized
+   */
+  bool no_wireframe;
+  overlay_t overlays[2];
+  overlay_t *overlay;
+  overlay_t *pending;
+} pipeline = {.overlay = &pipeline.overlays[0]};
+
+/* Transform every vertex of a mesh into the clip space buffer */
+static void transform_vertices(const mesh_t *mesh, const mat4_t *mvp) {
+  mulm4p3_soa(mvp, mesh->x, mesh->y, mesh->z, pipeline.clip_x,
+              pipeline.clip_y, pipeline.clip_z, pipeline.clip_w,
+              mesh->vert_count);
+}
+/* Get the outcode of a clip space position, for a volume of +-gx, +-gy */
+static u8 outcode(vec4_t v, f32 gx, f32 gy) {
+  u8 code = 0;
+  if (v.z < 0)
+    code |= CLIP_NEAR;
+  if (v.z > v.w)
+    code |= CLIP_FAR;
+  if (v.x < -gx * v.w)
+    code |= CLIP_LEFT;
+  if (v.x > gx * v.w)
+    code |= CLIP_RIGHT;
+  if (v.y < -gy * v.w)
+    code |= CLIP_BOTTOM;
+  if (v.y > gy * v.w)
+    code |= CLIP_TOP;
+  return code;
+}
+/* Signed distance of a clip space position to a guard band plane */
+static f32 plane_dist(vec4_t v, u32 plane) {
+  switch (plane) {
+  case 0:
+    return v.z;
+  case 1:
+    return v.w - v.z;
+  case 2:
+    return v.x + pipeline.guard_x * v.w;
+  case 3:
+    return pipeline.guard_x * v.w - v.x;
+  case 4:
+    return v.y + pipeline.guard_y * v.w;
+  default:
+    return pipeline.guard_y * v.w - v.y;
+  }
+}
+/* Map a clip space position inside the guard band to screen space */
+static vec3_t to_screen(vec4_t v) {
+  /* Perspective divide */
+  f32 inv_w = 1.0f / v.w;
+  v.x *= inv_w;
+  v.y *= inv_w;
+  v.z *= inv_w;
+  /* Scale into view, y pointing down */
+  v.x = (v.x + 1.0f) * 0.5f * pipeline.target.width;
+  v.y = (1.0f - v.y) * 0.5f * pipeline.target.height;
+  return VTOVEC3(v);
+}
+/* Get a transformed vertex through the post-transform cache */
+static cache_entry_t fetch_vertex(u32 index) {
+  cache_entry_t *entry = &pipeline.cache[index & (VERTEX_CACHE_SIZE - 1)];
+  if (entry->index == index)
+    return *entry;
+  vec4_t v = {
+      pipeline.clip_x[index], pipeline.clip_y[index],
+      pipeline.clip_z[index], pipeline.clip_w[index],
+  };
+  entry->index = index;
+  entry->view_code = outcode(v, 1.0f, 1.0f);
+  entry->clip_code = outcode(v, pipeline.guard_x, pipeline.guard_y);
+  if (entry->clip_code == 0) {
+    entry->pos = to_screen(v);
+    if (pipeline.texture)
+      entry->q = 1.0f / v.w;
+  }
+  return *entry;
+}
+/* Interpolate from a vertex inside a plane to one outside it */
+static clip_vert_t lerp_clip_vert(const clip_vert_t *in,
+                                  const clip_vert_t *out, f32 t) {
+  clip_vert_t res;
+  res.pos.x = in->pos.x + (out->pos.x - in->pos.x) * t;
+  res.pos.y = in->pos.y + (out->pos.y - in->pos.y) * t;
+  res.pos.z = in->pos.z + (out->pos.z - in->pos.z) * t;
+  res.pos.w = in->pos.w + (out->pos.w - in->pos.w) * t;
+  res.col.x = in->col.x + (out->col.x - in->col.x) * t;
+  res.col.y = in->col.y + (out->col.y - in->col.y) * t;
+  res.col.z = in->col.z + (out->col.z - in->col.z) * t;
+  res.col.w = in->col.w + (out->col.w - in->col.w) * t;
+  res.uv.x = in->uv.x + (out->uv.x - in->uv.x) * t;
+  res.uv.y = in->uv.y + (out->uv.y - in->uv.y) * t;
+  return res;
+}
+/*
+ * Clip a convex polygon against the planes set in a mask (Sutherland-
+ * Hodgman), in place. Returns the number of vertices left.
+ */
+static u32 clip_polygon(clip_vert_t *verts, u32 count, u8 planes) {
+  clip_vert_t tmp[CLIP_MAX_VERTS];
+  clip_vert_t *src = verts, *dst = tmp;
+  for (u32 plane = 0; plane < CLIP_PLANES && count >= 3; plane++) {
+    if (!(planes & (1 << plane)))
+      continue;
+    u32 out_count = 0;
+    for (u32 i = 0; i < count; i++) {
+      const clip_vert_t *a = &src[i];
+      const clip_vert_t *b = &src[(i + 1) % count];
+      f32 da = plane_dist(a->pos, plane);
+      f32 db = plane_dist(b->pos, plane);
+      if (da >= 0)
+        dst[out_count++] = *a;
+      /*
+       * Always interpolate from the inside vertex, so an edge shared by two
+       * triangles is split at the same point in both
+       */
+      if (da >= 0 && db < 0)
+        dst[out_count++] = lerp_clip_vert(a, b, da / (da - db));
+      else if (da < 0 && db >= 0)
+        dst[out_count++] = lerp_clip_vert(b, a, db / (db - da));
+    }
+    SWAP(src, dst);
+    count = out_count;
+  }
+  if (src != verts)
+    memcpy(verts, src, sizeof(clip_vert_t) * count);
+  return count;
+}
+/* Send a screen space triangle to the rasterizer */
+static void submit_tri(tri_t tri, tri_col_t cols, const tri_tex_t *tex) {
+  tiles_submit(tri, cols, tex);
+  if (pipeline.no_wireframe)
+    return;
+  /* Keep it for the wireframe overlay, drawn once the tiles are filled */
+  overlay_t *overlay = pipeline.overlay;
+  if (overlay->count == overlay->capacity) {
+    u64 capacity = MAX(overlay->capacity * 2, 64);
+    tri_t *tris = realloc(overlay->tris, sizeof(tri_t) * capacity);
+    if (!tris)
+      return; /* Out of memory, leave it out of the overlay */
+    overlay->tris = tris;
+    overlay->capacity = capacity;
+  }
+  overlay->tris[overlay->count++] = tri;
+}
+/* Cull the batched triangles and send the rest to the rasterizer */
+static void flush_tris(void) {
+  setup_batch_t *batch = &pipeline.batch;
+  u32 visible[CULL_BATCH];
+  u32 back_facing = 0;
+  u32 count = culltris(&pipeline.target, batch->tris, batch->count, visible,
+                       &back_facing);
+  batch->back_facing += back_facing;
+  batch->empty += batch->count - count - back_facing;
+  for (u32 i = 0; i < count; i++) {
+    u32 index = visible[i];
+    submit_tri(batch->tris[index], batch->cols[index],
+               pipeline.texture ? &batch->texs[index] : NULL);
+  }
+  batch->count = 0;
+}
+/* Queue a screen space triangle for culling and setup */
+static void queue_tri(tri_t tri, tri_col_t cols, const tri_tex_t *tex) {
+  setup_batch_t *batch = &pipeline.batch;
+  batch->tris[batch->count] = tri;
+  batch->cols[batch->count] = cols;
+  if (tex)
+    batch->texs[batch->count] = *tex;
+  if (++batch->count == CULL_BATCH)
+    flush_tris();
+}
+/* Draw a wireframe overlay onto its target */
+static void draw_overlay(const overlay_t *overlay) {
+  const target_t *target = &overlay->target;
+  for (u64 i = 0; i < overlay->count; i++) {
+    tri_t tri = overlay->tris[i];
+    putline(target, tri.v0.x, tri.v0.y, tri.v1.x, tri.v1.y,
+            (col_t){0x7f, 0x7f, 0x7f, 0xff});
+    putline(target, tri.v2.x, tri.v2.y, tri.v1.x, tri.v1.y,
+            (col_t){0x7f, 0x7f, 0x7f, 0xff});
+    putline(target, tri.v2.x, tri.v2.y, tri.v0.x, tri.v0.y,
+            (col_t){0x7f, 0x7f, 0x7f, 0xff});
+    putpixel(target, tri.v0.x, tri.v0.y, (col_t){0xff, 0xff, 0xff, 0xff});
+    putpixel(target, tri.v1.x, tri.v1.y, (col_t){0xff, 0xff, 0xff, 0xff});
+    putpixel(target, tri.v2.x, tri.v2.y, (col_t){0xff, 0xff, 0xff, 0xff});
+  }
+}
+
+/* Turn the wireframe overlay on or off (on by default) */
+void pipeline_set_wireframe(bool enabled) {
+  pipeline.no_wireframe = !enabled;
+}
+/* Start a frame on a render target, seen through a view-projection matrix */
+void pipeline_begin(const target_t *target, mat4_t view_proj) {
+  pipeline.target = *target;
+  pipeline.view_proj = view_proj;
+  pipeline.guard_x = 1.0f + 2.0f * GUARD_BAND / target->width;
+  pipeline.guard_y = 1.0f + 2.0f * GUARD_BAND / target->height;
+  arena_reset(&pipeline.arena);
+  pipeline.overlay->target = *target;
+  pipeline.overlay->count = 0;
+  tiles_begin(target);
+}
+/* Clear the target as its tiles are filled, before anything is drawn */
+void pipeline_clear(col_t col) {
+  tiles_clear(col);
+}
+/* Clip a triangle against the guard band and send what is left */
+static void clip_tri(const u32 *corners, tri_col_t cols, u8 planes) {
+  clip_vert_t verts[CLIP_MAX_VERTS];
+  const col_t *corner_cols[3] = {&cols.c0, &cols.c1, &cols.c2};
+  for (u32 i = 0; i < 3; i++) {
+    u32 index = corners[i];
+    verts[i].pos = (vec4_t){
+        pipeline.clip_x[index], pipeline.clip_y[index],
+        pipeline.clip_z[index], pipeline.clip_w[index],
+    };
+    verts[i].col = (vec4_t){
+        corner_cols[i]->r, corner_cols[i]->g,
+        corner_cols[i]->b, corner_cols[i]->a,
+    };
+    if (pipeline.texture)
+      verts[i].uv = (vec2_t){pipeline.u[index], pipeline.v[index]};
+  }
+  u32 count = clip_polygon(verts, 3, planes);
+  if (count < 3)
+    return;
+
+  /* Send the clipped polygon as a triangle fan */
+  vec3_t screen[CLIP_MAX_VERTS];
+  col_t screen_cols[CLIP_MAX_VERTS];
+  for (u32 i = 0; i < count; i++) {
+    screen[i] = to_screen(verts[i].pos);
+    screen_cols[i] = (col_t){
+        verts[i].col.x + 0.5f, verts[i].col.y + 0.5f,
+        verts[i].col.z + 0.5f, verts[i].col.w + 0.5f,
+    };
+  }
+  for (u32 i = 1; i + 1 < count; i++) {
+    tri_t tri = {screen[0], screen[i], screen[i + 1]};
+    tri_col_t tri_cols = {screen_cols[0], screen_cols[i], screen_cols[i + 1]};
+    if (!pipeline.texture) {
+      queue_tri(tri, tri_cols, NULL);
+      continue;
+    }
+    tri_tex_t tex = {
+        pipeline.texture,
+        verts[0].uv, verts[i].uv, verts[i + 1].uv,
+        1.0f / verts[0].pos.w, 1.0f / verts[i].pos.w,
+        1.0f / verts[i + 1].pos.w,
+    };
+    queue_tri(tri, tri_cols, &tex);
+  }
+}
+/* Multiply a triangle's colours by an instance colour */
+static tri_col_t tint_cols(tri_col_t cols, col_t color) {
+  col_t *corner_cols[3] = {&cols.c0, &cols.c1, &cols.c2};
+  for (u32 i = 0; i < 3; i++) {
+    col_t *col = corner_cols[i];
+    col->r = (col->r * color.r + 127) / 255;
+    col->g = (col->g * color.g + 127) / 255;
+    col->b = (col->b * color.b + 127) / 255;
+    col->a = (col->a * color.a + 127) / 255;
+  }
+  return cols;
+}
+/*
+ * Check whether a triangle faces away from the eye, from its clip space
+ * corners. The determinant of their x, y and w has the sign of the
+ * triangle's winding as seen from the eye, wherever the eye and the model
+ * are, and needs no divide so it also holds for corners behind the eye.
+ * It is checked before a triangle's corners are fetched, so most back
+ * faces cost nothing more; culltris() settles the few whose winding is
+ * changed by snapping to the pixel grid.
+ */
+static bool back_facing(const u32 *corners) {
+  u32 a = corners[0], b = corners[1], c = corners[2];
+  f32 det = pipeline.clip_x[a]
+              * (pipeline.clip_y[b] * pipeline.clip_w[c]
+                 - pipeline.clip_w[b] * pipeline.clip_y[c])
+          - pipeline.clip_y[a]
+              * (pipeline.clip_x[b] * pipeline.clip_w[c]
+                 - pipeline.clip_w[b] * pipeline.clip_x[c])
+          + pipeline.clip_w[a]
+              * (pipeline.clip_x[b] * pipeline.clip_y[c]
+                 - pipeline.clip_y[b] * pipeline.clip_x[c]);
+  return det > 0;
+}
+/* Draw one instance of a mesh */
+static void draw_instance(const mesh_t *mesh, const instance_t *instance,
+                          u32 *culled, u32 *clipped) {
+  /* Vertex processing */
+  profiler_push(PROF_VERTEX);
+  mat4_t mvp = mulm4(pipeline.view_proj, instance->model);
+  transform_vertices(mesh, &mvp);
+
+  /* Primitive assembly */
+  profiler_push(PROF_CLIP);
+  bool tinted = instance->color.r != 0xff || instance->color.g != 0xff
+      || instance->color.b != 0xff || instance->color.a != 0xff;
+  pipeline.texture = mesh->u ? instance->texture : NULL;
+  pipeline.u = mesh->u;
+  pipeline.v = mesh->v;
+  for (u32 i = 0; i < VERTEX_CACHE_SIZE; i++) {
+    pipeline.cache[i].index = UINT32_MAX;
+  }
+  for (u32 i = 0; i < mesh->tri_count; i++) {
+    const u32 *corners = mesh->indices + (3 * i);
+    if (back_facing(corners)) {
+      (*culled)++;
+      continue;
+    }
+    cache_entry_t v0 = fetch_vertex(corners[0]);
+    cache_entry_t v1 = fetch_vertex(corners[1]);
+    cache_entry_t v2 = fetch_vertex(corners[2]);
+    /* Drop triangles entirely outside one of the view planes */
+    if (v0.view_code & v1.view_code & v2.view_code) {
+      (*culled)++;
+      continue;
+    }
+    tri_col_t cols = mesh_tri_cols(mesh, i);
+    if (tinted)
+      cols = tint_cols(cols, instance->color);
+    /* Clip the ones reaching past the guard band */
+    u8 planes = v0.clip_code | v1.clip_code | v2.clip_code;
+    if (planes) {
+      (*clipped)++;
+      clip_tri(corners, cols, planes);
+      continue;
+    }
+    tri_t tri = {v0.pos, v1.pos, v2.pos};
+    if (!pipeline.texture) {
+      queue_tri(tri, cols, NULL);
+      continue;
+    }
+    tri_tex_t tex = {
+        pipeline.texture,
+        {pipeline.u[corners[0]], pipeline.v[corners[0]]},
+        {pipeline.u[corners[1]], pipeline.v[corners[1]]},
+        {pipeline.u[corners[2]], pipeline.v[corners[2]]},
+        v0.q, v1.q, v2.q,
+    };
+    queue_tri(tri, cols, &tex);
+  }
+  flush_tris();
+}
+/* Draw count instances of a mesh, all sharing its vertex data */
+void pipeline_draw_instances(const mesh_t *mesh, const instance_t *instances,
+                             u32 count) {
+  prof_stage_t prev_stage = profiler_push(PROF_VERTEX);
+  /* Every instance reuses one clip space buffer, given back afterwards */
+  arena_mark_t mark = arena_mark(&pipeline.arena);
+  u64 stream_size = sizeof(f32) * mesh->vert_count;
+  pipeline.clip_x = arena_alloc(&pipeline.arena, stream_size);
+  pipeline.clip_y = arena_alloc(&pipeline.arena, stream_size);
+  pipeline.clip_z = arena_alloc(&pipeline.arena, stream_size);
+  pipeline.clip_w = arena_alloc(&pipeline.arena, stream_size);
+  if (!pipeline.clip_x || !pipeline.clip_y || !pipeline.clip_z
+      || !pipeline.clip_w) {
+    /* Out of memory, skip the draw */
+    arena_rewind(&pipeline.arena, mark);
+    profiler_pop(prev_stage);
+    return;
+  }
+  u32 culled = 0, clipped = 0;
+  for (u32 i = 0; i < count; i++) {
+    draw_instance(mesh, &instances[i], &culled, &clipped);
+  }
+  arena_rewind(&pipeline.arena, mark);
+  profiler_count(PROF_TRIS_SUBMITTED, (u64)mesh->tri_count * count);
+  profiler_count(PROF_TRIS_CULLED, culled + pipeline.batch.back_facing);
+  profiler_count(PROF_TRIS_EMPTY, pipeline.batch.empty);
+  profiler_count(PROF_TRIS_CLIPPED, clipped);
+  pipeline.batch.back_facing = 0;
+  pipeline.batch.empty = 0;
+  profiler_pop(prev_stage);
+}
+/* Get the transient memory of the frame being drawn */
+arena_t *pipeline_arena(void) {
+  return &pipeline.arena;
+}
+/* Rasterize everything drawn since pipeline_begin() and draw the overlay */
+void pipeline_end(void) {
+  pipeline_finish();
+  prof_stage_t prev_stage = profiler_push(PROF_RASTER);
+  tiles_flush();
+  draw_overlay(pipeline.overlay);
+  profiler_pop(prev_stage);
+}
+/* Start rasterizing the frame in the background, see pipeline.h */
+void pipeline_submit(void) {
+  pipeline_finish();
+  tiles_kick();
+  pipeline.pending = pipeline.overlay;
+  pipeline.overlay = pipeline.overlay == &pipeline.overlays[0]
+                         ? &pipeline.overlays[1]
+                         : &pipeline.overlays[0];
+}
+/* Wait for the frame from pipeline_submit() and draw its overlay */
+void pipeline_finish(void) {
+  if (!pipeline.pending)
+    return;
+  prof_stage_t prev_stage = profiler_push(PROF_RASTER);
+  tiles_wait();
+  draw_overlay(pipeline.pending);
+  pipeline.pending = NULL;
+  profiler_pop(prev_stage);
+}
+/* Free the pipeline's buffers */
+void pipeline_quit(void) {
+  pipeline_finish();
+  arena_free(&pipeline.arena);
+  for (u32 i = 0; i < 2; i++) {
+    free(pipeline.overlays[i].tris);
+    pipeline.overlays[i] = (overlay_t){0};
+  }
+}
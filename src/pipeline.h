@@ -0,0 +1,85 @@
+/* Include guard */
+#if !defined(PIPELINE_H)
+#define PIPELINE_H
+
+/* Project headers */
+#include "arena.h"  /* Transient allocations */
+#include "math3d.h" /* Vector and matrix math */
+#include "mesh.h"   /* Indexed meshes */
+#include "raster.h" /* Render targets */
+
+/* Consts */
+#define VERTEX_CACHE_SIZE 32 /* Entries in the post-transform cache, 2^n */
+#define CLIP_PLANES 6        /* Near, far and the four guard band planes */
+
+/*
+ * Geometry pipeline. Meshes are drawn as instances, each placing the mesh
+ * with its own model matrix, and every instance goes through:
+ *  1. Vertex processing: model, view and projection are concatenated once
+ *     per instance, then all vertices are transformed in one batched pass
+ *     into a clip space buffer. The mesh's own vertices are never changed.
+ *  2. Primitive assembly: triangles are gathered from the index buffer and
+ *     back faces dropped, by the winding of their clip space corners.
+ *     Corners are perspective divided and mapped to the viewport through a
+ *     small post-transform cache, so a vertex shared by neighbouring
+ *     triangles is only finished once.
+ *  3. Clipping: triangles entirely outside the view are dropped. The rest
+ *     are clipped in clip space (Sutherland-Hodgman) against the near and
+ *     far planes and a guard band of GUARD_BAND pixels around the target,
+ *     so only triangles that need it pay for clipping.
+ *  4. Culling: screen space triangles are culled in batches by their
+ *     signed area once snapped to the pixel grid, so ones of zero area and
+ *     the many tiny ones of dense meshes that fall between pixel centres
+ *     never pay for setup.
+ *  5. Rasterization: screen space triangles go to the tiled rasterizer,
+ *     which scissors their bounding boxes to the target. Textured instances
+ *     also pass each corner's texture coordinates and 1/w, so the
+ *     rasterizer can interpolate them with perspective correction.
+ */
+
+/* One placement of a mesh */
+typedef struct {
+  mat4_t model; /* Object to world transform */
+  col_t color;  /* Multiplies the vertex colours, white to keep them */
+  /*
+   * Multiplied by the vertex colours, or NULL to draw with the colours
+   * alone. Ignored for meshes without texture coordinates.
+   */
+  const texture_t *texture;
+} instance_t;
+
+/* Turn the wireframe overlay on or off (on by default) */
+void pipeline_set_wireframe(bool enabled);
+/* Start a frame on a render target, seen through a view-projection matrix */
+void pipeline_begin(const target_t *target, mat4_t view_proj);
+/*
+ * Clear the target's color, depth and coarse depth, right after
+ * pipeline_begin(). The clear is deferred to the tiled rasterizer (see
+ * tiles_clear()), so each pixel is written once while its tile is in the
+ * cache rather than in a separate pass over the whole target.
+ */
+void pipeline_clear(col_t col);
+/* Draw count instances of a mesh, all sharing its vertex data */
+void pipeline_draw_instances(const mesh_t *mesh, const instance_t *instances,
+                             u32 count);
+/*
+ * Get the transient memory of the frame being drawn, for use on the
+ * drawing thread. It is reset by pipeline_begin().
+ */
+arena_t *pipeline_arena(void);
+/* Rasterize everything drawn since pipeline_begin() and draw the overlay */
+void pipeline_end(void);
+/*
+ * Pipelined alternative to pipeline_end(): start rasterizing everything
+ * drawn since pipeline_begin() on the tile workers and return straight
+ * away, so the next frame's geometry can run meanwhile on another target.
+ * The target is complete after pipeline_finish(), or the next
+ * pipeline_submit() or pipeline_end().
+ */
+void pipeline_submit(void);
+/* Wait for the frame from pipeline_submit(), if any, and draw its overlay */
+void pipeline_finish(void);
+/* Free the pipeline's buffers */
+void pipeline_quit(void);
+
+#endif /* PIPELINE_H */
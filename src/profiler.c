@@ -0,0 +1,238 @@
+/* Implements profiler.h */
+#include "profiler.h"
+
+/* SDL2, for the performance counter */
+#include <SDL2/SDL.h>
+
+/* C Stdlib headers */
+#include <math.h>   /* ceil() */
+#include <stdio.h>  /* File and console I/O */
+#include <stdlib.h> /* qsort() */
+#include <string.h> /* memset(), strlen(), strcmp() */
+
+/* Everything recorded for one frame */
+typedef struct {
+  f64 stage_ms[PROF_STAGE_COUNT];
+  f64 total_ms;
+  u64 counters[PROF_COUNTER_COUNT];
+  u64 pixels;
+} frame_record_t;
+
+/* Names of the stages and counters, as used in reports and traces */
+static const char *stage_names[PROF_STAGE_COUNT] = {
+    [PROF_OTHER] = "other",
+    [PROF_CLEAR] = "clear",
+    [PROF_VERTEX] = "vertex",
+    [PROF_CLIP] = "clip",
+    [PROF_SETUP] = "setup",
+    [PROF_RASTER] = "raster",
+    [PROF_PRESENT] = "present",
+};
+static const char *counter_names[PROF_COUNTER_COUNT] = {
+    [PROF_INSTANCES_DRAWN] = "instances_drawn",
+    [PROF_INSTANCES_CULLED] = "instances_culled",
+    [PROF_TRIS_SUBMITTED] = "tris_submitted",
+    [PROF_TRIS_CULLED] = "tris_culled",
+    [PROF_TRIS_EMPTY] = "tris_empty",
+    [PROF_TRIS_CLIPPED] = "tris_clipped",
+    [PROF_PIXELS_TESTED] = "pixels_tested",
+    [PROF_DEPTH_PASSES] = "depth_passes",
+    [PROF_PIXELS_SHADED] = "pixels_shaded",
+};
+
+/* Profiler state */
+static struct {
+  bool enabled;
+  f64 ms_per_tick;
+  /* Trace output */
+  FILE *trace;
+  bool json;
+  /* Current frame */
+  u64 frame_start;
+  u64 stage_start;
+  prof_stage_t stage;
+  frame_record_t frame;
+  /* Last PROFILER_WINDOW frames, oldest overwritten first */
+  frame_record_t history[PROFILER_WINDOW];
+  u64 frame_count;
+} profiler;
+
+/* Charge the time since the last stage change to the current stage */
+static void charge_stage(void) {
+  u64 now = SDL_GetPerformanceCounter();
+  profiler.frame.stage_ms[profiler.stage] +=
+      (now - profiler.stage_start) * profiler.ms_per_tick;
+  profiler.stage_start = now;
+}
+/* Get the overdraw of a frame: depth test passes per pixel */
+static f64 overdraw(const frame_record_t *frame) {
+  return frame->pixels ? (f64)frame->counters[PROF_DEPTH_PASSES]
+                             / frame->pixels
+                       : 0.0;
+}
+/* Write a frame to the trace */
+static void write_trace(const frame_record_t *frame, u64 index) {
+  FILE *out = profiler.trace;
+  if (profiler.json) {
+    fprintf(out, "%s\n  {\"frame\": %llu, \"total_ms\": %.4f",
+            index ? "," : "", (unsigned long long)index, frame->total_ms);
+    for (u32 i = 0; i < PROF_STAGE_COUNT; i++) {
+      fprintf(out, ", \"%s_ms\": %.4f", stage_names[i], frame->stage_ms[i]);
+    }
+    for (u32 i = 0; i < PROF_COUNTER_COUNT; i++) {
+      fprintf(out, ", \"%s\": %llu", counter_names[i],
+              (unsigned long long)frame->counters[i]);
+    }
+    fprintf(out, ", \"overdraw\": %.4f}", overdraw(frame));
+  } else {
+    fprintf(out, "%llu,%.4f", (unsigned long long)index, frame->total_ms);
+    for (u32 i = 0; i < PROF_STAGE_COUNT; i++) {
+      fprintf(out, ",%.4f", frame->stage_ms[i]);
+    }
+    for (u32 i = 0; i < PROF_COUNTER_COUNT; i++) {
+      fprintf(out, ",%llu", (unsigned long long)frame->counters[i]);
+    }
+    fprintf(out, ",%.4f\n", overdraw(frame));
+  }
+}
+/* Compare two f64s, for qsort() */
+static int compare_f64(const void *a, const void *b) {
+  f64 x = *(const f64 *)a, y = *(const f64 *)b;
+  return (x > y) - (x < y);
+}
+/* Get a percentile (0-100) of a sorted array, nearest rank */
+static f64 percentile(const f64 *sorted, u64 count, f64 p) {
+  u64 rank = (u64)ceil(p / 100.0 * count);
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/* Start profiling, optionally writing a trace of every frame */
+bool profiler_init(const char *trace_path) {
+  memset(&profiler, 0, sizeof(profiler));
+  profiler.ms_per_tick = 1000.0 / SDL_GetPerformanceFrequency();
+  if (trace_path) {
+    profiler.trace = fopen(trace_path, "w");
+    if (!profiler.trace)
+      return false;
+    size_t len = strlen(trace_path);
+    profiler.json = len >= 5 && strcmp(trace_path + len - 5, ".json") == 0;
+    if (profiler.json) {
+      fprintf(profiler.trace, "[");
+    } else {
+      fprintf(profiler.trace, "frame,total_ms");
+      for (u32 i = 0; i < PROF_STAGE_COUNT; i++) {
+        fprintf(profiler.trace, ",%s_ms", stage_names[i]);
+      }
+      for (u32 i = 0; i < PROF_COUNTER_COUNT; i++) {
+        fprintf(profiler.trace, ",%s", counter_names[i]);
+      }
+      fprintf(profiler.trace, ",overdraw\n");
+    }
+  }
+  profiler.enabled = true;
+  return true;
+}
+/* Stop profiling and close the trace */
+void profiler_quit(void) {
+  if (profiler.trace) {
+    if (profiler.json)
+      fprintf(profiler.trace, "\n]\n");
+    fclose(profiler.trace);
+    profiler.trace = NULL;
+  }
+  profiler.enabled = false;
+}
+/* Check whether the profiler is running */
+bool profiler_enabled(void) {
+  return profiler.enabled;
+}
+
+/* Start a frame */
+void profiler_frame_begin(void) {
+  if (!profiler.enabled)
+    return;
+  memset(&profiler.frame, 0, sizeof(profiler.frame));
+  profiler.frame_start = SDL_GetPerformanceCounter();
+  profiler.stage_start = profiler.frame_start;
+  profiler.stage = PROF_OTHER;
+}
+/* End a frame covering a number of pixels, and record it */
+void profiler_frame_end(u64 pixels) {
+  if (!profiler.enabled)
+    return;
+  charge_stage();
+  profiler.frame.total_ms =
+      (profiler.stage_start - profiler.frame_start) * profiler.ms_per_tick;
+  profiler.frame.pixels = pixels;
+  profiler.history[profiler.frame_count % PROFILER_WINDOW] = profiler.frame;
+  if (profiler.trace)
+    write_trace(&profiler.frame, profiler.frame_count);
+  profiler.frame_count++;
+}
+
+/* Enter a stage, returns the stage to go back to with profiler_pop() */
+prof_stage_t profiler_push(prof_stage_t stage) {
+  if (!profiler.enabled)
+    return PROF_OTHER;
+  prof_stage_t prev = profiler.stage;
+  charge_stage();
+  profiler.stage = stage;
+  return prev;
+}
+/* Leave the current stage for the one returned by profiler_push() */
+void profiler_pop(prof_stage_t stage) {
+  if (!profiler.enabled)
+    return;
+  charge_stage();
+  profiler.stage = stage;
+}
+/* Add to a counter of the current frame */
+void profiler_count(prof_counter_t counter, u64 n) {
+  if (!profiler.enabled)
+    return;
+  profiler.frame.counters[counter] += n;
+}
+/* Get a counter of the last recorded frame */
+u64 profiler_frame_counter(prof_counter_t counter) {
+  if (profiler.frame_count == 0)
+    return 0;
+  u64 last = (profiler.frame_count - 1) % PROFILER_WINDOW;
+  return profiler.history[last].counters[counter];
+}
+
+/* Print rolling percentiles of the recorded frames to stdout */
+void profiler_report(void) {
+  u64 count = MIN(profiler.frame_count, PROFILER_WINDOW);
+  if (!profiler.enabled || count == 0)
+    return;
+  f64 samples[PROFILER_WINDOW];
+  printf("PROFILE: last %llu frames   p50 ms   p90 ms   p99 ms   max ms\n",
+         (unsigned long long)count);
+  /* Stage times, with the frame total as the last row */
+  for (u32 stage = 0; stage <= PROF_STAGE_COUNT; stage++) {
+    for (u64 i = 0; i < count; i++) {
+      const frame_record_t *frame = &profiler.history[i];
+      samples[i] = stage < PROF_STAGE_COUNT ? frame->stage_ms[stage]
+                                            : frame->total_ms;
+    }
+    qsort(samples, count, sizeof(f64), compare_f64);
+    printf("  %-21s %8.3f %8.3f %8.3f %8.3f\n",
+           stage < PROF_STAGE_COUNT ? stage_names[stage] : "total",
+           percentile(samples, count, 50), percentile(samples, count, 90),
+           percentile(samples, count, 99), samples[count - 1]);
+  }
+  /* Counters, averaged per frame */
+  f64 avg_overdraw = 0.0;
+  for (u64 i = 0; i < count; i++) {
+    avg_overdraw += overdraw(&profiler.history[i]);
+  }
+  printf("  per frame: ");
+  for (u32 counter = 0; counter < PROF_COUNTER_COUNT; counter++) {
+    u64 sum = 0;
+    for (u64 i = 0; i < count; i++) {
+      sum += profiler.history[i].counters[counter];
+    }
+    printf("%s %.1f, ", counter_names[counter], (f64)sum / count);
+  }
+  printf("overdraw %.2f\n", avg_overdraw / count);
+}
@@ -0,0 +1,81 @@
+/* Include guard */
+#if !defined(PROFILER_H)
+#define PROFILER_H
+
+/* C Stdlib headers */
+#include <stdbool.h> /* For boolean type */
+
+/* Project headers */
+#include "math3d.h" /* Integer types */
+
+/* Consts */
+#define PROFILER_WINDOW 120 /* Frames kept for the rolling percentiles */
+
+/*
+ * Frame profiler. Each frame is split into stages timed with the
+ * performance counter; stages nest, and time is only charged to the
+ * innermost one, so the stage times of a frame add up to its total.
+ * Counters are summed per frame. The last PROFILER_WINDOW frames are kept
+ * for rolling percentiles, and every frame can be written to a CSV or JSON
+ * trace. While disabled every call returns straight away.
+ *
+ * Stages and counters are only recorded from the thread running the
+ * frame; work done on other threads is reported from there once it is
+ * complete.
+ */
+
+/* The stages of a frame */
+typedef enum {
+  PROF_OTHER,   /* Time not in any other stage */
+  PROF_CLEAR,   /* Clearing the color and depth buffers */
+  PROF_VERTEX,  /* Transforming vertices */
+  PROF_CLIP,    /* Primitive assembly, culling and clipping */
+  PROF_SETUP,   /* Triangle setup and binning */
+  PROF_RASTER,  /* Filling tiles and drawing the overlay */
+  PROF_PRESENT, /* Handing the frame to the display */
+  PROF_STAGE_COUNT
+} prof_stage_t;
+
+/* The per frame counters */
+typedef enum {
+  PROF_INSTANCES_DRAWN,  /* Mesh instances passing frustum culling */
+  PROF_INSTANCES_CULLED, /* Mesh instances entirely outside the view */
+  PROF_TRIS_SUBMITTED,   /* Triangles entering primitive assembly */
+  PROF_TRIS_CULLED,      /* Back facing or entirely outside the view */
+  PROF_TRIS_EMPTY,       /* Of zero area or covering no pixel centre */
+  PROF_TRIS_CLIPPED,     /* Needed clipping against the guard band */
+  PROF_PIXELS_TESTED,    /* Covered pixels that were depth tested */
+  PROF_DEPTH_PASSES,     /* Pixels that passed the depth test */
+  PROF_PIXELS_SHADED,    /* Pixels whose colour was worked out */
+  PROF_COUNTER_COUNT
+} prof_counter_t;
+
+/*
+ * Start profiling. A trace of every frame is written to trace_path if it
+ * isn't NULL, as JSON if it ends in ".json" and CSV otherwise. Returns
+ * false if the trace can't be opened.
+ */
+bool profiler_init(const char *trace_path);
+/* Stop profiling and close the trace */
+void profiler_quit(void);
+/* Check whether the profiler is running */
+bool profiler_enabled(void);
+
+/* Start a frame */
+void profiler_frame_begin(void);
+/* End a frame covering a number of pixels, and record it */
+void profiler_frame_end(u64 pixels);
+
+/* Enter a stage, returns the stage to go back to with profiler_pop() */
+prof_stage_t profiler_push(prof_stage_t stage);
+/* Leave the current stage for the one returned by profiler_push() */
+void profiler_pop(prof_stage_t stage);
+/* Add to a counter of the current frame */
+void profiler_count(prof_counter_t counter, u64 n);
+/* Get a counter of the last recorded frame */
+u64 profiler_frame_counter(prof_counter_t counter);
+
+/* Print rolling percentiles of the recorded frames to stdout */
+void profiler_report(void);
+
+#endif /* PROFILER_H */
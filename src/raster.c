@@ -0,0 +1,1439 @@
+/* Implements raster.h */
+#include "raster.h"
+
+/* SDL2, for CPU feature detection */
+#include <SDL2/SDL.h>
+
+/* C Stdlib headers */
+#include <math.h>   /* fabsf(), INFINITY */
+#include <stdlib.h> /* abs(), malloc() */
+#include <string.h> /* memcpy(), memset() */
+
+/* SIMD intrinsics (x86 only) */
+#if defined(__x86_64__) || defined(__i386__)
+#define RASTER_X86
+#include <immintrin.h>
+#endif
+
+/* Consts */
+#define DEPTH_EPSILON 1e-6f /* Relative slack on a triangle's depth range */
+/*
+ * Scale on a pixel's depth for the test after a depth pre-pass. Math may
+ * be reassociated (-ffast-math), so kernel variants can round the same
+ * pixel's depth differently by a few ulps.
+ */
+#define DEPTH_EQUAL_SCALE (1.0f + DEPTH_EPSILON)
+/*
+ * Largest edge function value the SIMD kernels are handed, leaving room
+ * for a block of steps either side without overflowing i32
+ */
+#define EDGE_LIMIT (1 << 30)
+
+/* Force a function inline, so the constant arguments it gets fold away */
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+/* What a kernel writes to the pixels that pass its depth test */
+typedef enum {
+  SHADE_COLOR,    /* The interpolated colour */
+  SHADE_TEXTURED, /* The colour multiplied by the texture */
+  SHADE_IDS,      /* The triangle's id, see target_t */
+  SHADE_COUNT
+} shade_mode_t;
+
+/* A triangle filling kernel, adds the pixels it tested and wrote to stats */
+typedef void (*kernel_fn_t)(const target_t *target, const tri_setup_t *setup,
+                            raster_stats_t *stats);
+/*
+ * A kernel's shading of a run of count pixels of a triangle, from a
+ * visibility buffer, the edge functions being w0, w1 and w2 at the first
+ */
+typedef void (*span_fn_t)(const tri_setup_t *setup, i64 w0, i64 w1, i64 w2,
+                          i32 count, u32 *color);
+
+/*
+ * Kernel variants. Each kernel is written once, as a body taking its fill
+ * and shade modes as arguments, and compiled once per pair of modes by
+ * KERNEL_VARIANTS() with them as constants. The bodies are inlined into
+ * every variant, so the per pixel loops hold no tests of either mode, and
+ * kernels[] picks the variant for each triangle as it is filled. A new
+ * mode costs one more variant per kernel, not a branch per pixel.
+ */
+#define KERNEL_VARIANT(body, attr, fill, shade)                             \
+  attr static void body##_##fill##_##shade(                                 \
+      const target_t *target, const tri_setup_t *setup,                     \
+      raster_stats_t *stats) {                                              \
+    body(target, setup, stats, fill, shade);                                \
+  }
+#define KERNEL_VARIANTS(body, attr)                                         \
+  KERNEL_VARIANT(body, attr, FILL_COLOR, SHADE_COLOR)                       \
+  KERNEL_VARIANT(body, attr, FILL_COLOR, SHADE_TEXTURED)                    \
+  KERNEL_VARIANT(body, attr, FILL_COLOR, SHADE_IDS)                         \
+  KERNEL_VARIANT(body, attr, FILL_DEPTH, SHADE_COLOR)                       \
+  KERNEL_VARIANT(body, attr, FILL_EQUAL, SHADE_COLOR)                       \
+  KERNEL_VARIANT(body, attr, FILL_EQUAL, SHADE_TEXTURED)                    \
+  KERNEL_VARIANT(body, attr, FILL_EQUAL, SHADE_IDS)
+/*
+ * The variants of a kernel by fill mode and shade mode. A depth only fill
+ * shades nothing, so it has one variant for every shade mode.
+ */
+#define KERNEL_TABLE(body)                                                  \
+  {                                                                         \
+    [FILL_COLOR] = {body##_FILL_COLOR_SHADE_COLOR,                          \
+                    body##_FILL_COLOR_SHADE_TEXTURED,                       \
+                    body##_FILL_COLOR_SHADE_IDS},                           \
+    [FILL_DEPTH] = {body##_FILL_DEPTH_SHADE_COLOR,                          \
+                    body##_FILL_DEPTH_SHADE_COLOR,                          \
+                    body##_FILL_DEPTH_SHADE_COLOR},                         \
+    [FILL_EQUAL] = {body##_FILL_EQUAL_SHADE_COLOR,                          \
+                    body##_FILL_EQUAL_SHADE_TEXTURED,                       \
+                    body##_FILL_EQUAL_SHADE_IDS},                           \
+  }
+/* Span variants likewise, for the shade modes that write colour */
+#define SPAN_VARIANT(body, attr, shade)                                     \
+  attr static void body##_##shade(const tri_setup_t *setup, i64 w0, i64 w1, \
+                                  i64 w2, i32 count, u32 *color) {          \
+    body(setup, w0, w1, w2, count, color, shade);                           \
+  }
+#define SPAN_VARIANTS(body, attr)                                           \
+  SPAN_VARIANT(body, attr, SHADE_COLOR)                                     \
+  SPAN_VARIANT(body, attr, SHADE_TEXTURED)
+#define SPAN_TABLE(body) {body##_SHADE_COLOR, body##_SHADE_TEXTURED}
+
+/* The type of a 2D integer vector (fixed point screen coordinates) */
+typedef struct {
+  i32 x, y;
+} vec2_int_t;
+/* Twice the signed area of the triangle a, b, p, in fixed point units */
+static inline i64 edge_function(vec2_int_t a, vec2_int_t b, vec2_int_t p) {
+  return (i64)(b.x - a.x) * (p.y - a.y) - (i64)(b.y - a.y) * (p.x - a.x);
+}
+/*
+ * Divide fixed point coordinates by SUBPIXEL_ONE, rounding towards negative
+ * infinity like floor_div() but in one shift (gcc shifts negative values
+ * arithmetically)
+ */
+static inline i32 floor_pixel(i32 a) {
+  return a >> SUBPIXEL_BITS;
+}
+/*
+ * Round down to an integer. Unlike floorf(), this needs no SSE4.1 and
+ * vectorizes on plain SSE2.
+ */
+static inline i32 floor_to_int(f32 a) {
+  i32 i = (i32)a;
+  return i - (a < (f32)i);
+}
+/* Divide rounding towards negative infinity */
+static inline i64 floor_div(i64 a, i64 b) {
+  return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+/*
+ * Set up the edge function a->b, starting at the pixel centre p. Pixels
+ * exactly on an edge belong to the triangle only if it is a top edge
+ * (horizontal, inside below) or a left edge (inside to its right), so two
+ * triangles sharing an edge never both cover a pixel on it.
+ *
+ * Values are stepped a whole pixel (SUBPIXEL_ONE units) at a time, so
+ * every step is a multiple of SUBPIXEL_ONE and the value can be divided by
+ * it (rounding down) without changing its sign at any pixel. What that and
+ * the bias take off is the same at every pixel too, so it is kept as the
+ * edge's offset and added back for barycentric coordinates, which would
+ * otherwise fall short of summing to 1 on small triangles.
+ */
+static inline edge_t setup_edge(vec2_int_t a, vec2_int_t b, vec2_int_t p) {
+  edge_t edge;
+  edge.step_x = a.y - b.y;
+  edge.step_y = b.x - a.x;
+  bool top_left = edge.step_x > 0 || (edge.step_x == 0 && edge.step_y > 0);
+  i64 value = edge_function(a, b, p);
+  edge.row = floor_div(value - !top_left, SUBPIXEL_ONE);
+  edge.offset = (f32)(value - edge.row * SUBPIXEL_ONE) / SUBPIXEL_ONE;
+  return edge;
+}
+
+/* Multiply a texel by a colour, both packed RGBA8888, keeping it opaque */
+static inline u32 modulate(u32 texel, u32 pixel) {
+  u32 r = ((texel >> 24) * (pixel >> 24) + 0xff) >> 8;
+  u32 g = (((texel >> 16) & 0xff) * ((pixel >> 16) & 0xff) + 0xff) >> 8;
+  u32 b = (((texel >> 8) & 0xff) * ((pixel >> 8) & 0xff) + 0xff) >> 8;
+  return (r << 24) | (g << 16) | (b << 8) | 0xff;
+}
+/*
+ * Texture a pixel of a triangle from its barycentric coordinates, and
+ * multiply it by its interpolated colour. The SIMD kernels do the same for
+ * a block of pixels with texcoords_sse2() and texcoords_avx2().
+ */
+static inline u32 shade_texel(const tri_setup_t *setup, f32 alpha, f32 beta,
+                              f32 gamma, u32 pixel) {
+  /* Perspective correct texture coordinates */
+  f32 q = alpha * setup->q0 + beta * setup->q1 + gamma * setup->q2;
+  f32 inv_q = 1.0f / q;
+  f32 u = (alpha * setup->uq0 + beta * setup->uq1 + gamma * setup->uq2)
+        * inv_q;
+  f32 v = (alpha * setup->vq0 + beta * setup->vq1 + gamma * setup->vq2)
+        * inv_q;
+  /* Their derivatives, by the quotient rule, in texels per pixel */
+  f32 du_dx = (setup->uq_dx - u * setup->q_dx) * inv_q;
+  f32 dv_dx = (setup->vq_dx - v * setup->q_dx) * inv_q;
+  f32 du_dy = (setup->uq_dy - u * setup->q_dy) * inv_q;
+  f32 dv_dy = (setup->vq_dy - v * setup->q_dy) * inv_q;
+  f32 rho2 = MAX(du_dx * du_dx + dv_dx * dv_dx, du_dy * du_dy + dv_dy * dv_dy);
+  /*
+   * The mip level is log2 of the texels stepped per pixel, half the log2
+   * of rho2, which a float's bits give piecewise linearly
+   */
+  union {
+    f32 f;
+    u32 u;
+  } bits = {rho2};
+  f32 lod = ((f32)bits.u * (1.0f / (1 << 23)) - 127.0f) * 0.5f;
+  return modulate(texture_sample(setup->texture, u, v, lod), pixel);
+}
+/* Shade a pixel of a triangle from its barycentric coordinates */
+static ALWAYS_INLINE u32 shade_pixel(const tri_setup_t *setup, f32 alpha,
+                                     f32 beta, f32 gamma, bool textured) {
+  const tri_col_t *cols = &setup->cols;
+  col_t col;
+  col.r = alpha * cols->c0.r + beta * cols->c1.r + gamma * cols->c2.r;
+  col.g = alpha * cols->c0.g + beta * cols->c1.g + gamma * cols->c2.g;
+  col.b = alpha * cols->c0.b + beta * cols->c1.b + gamma * cols->c2.b;
+  col.a = 0xff;
+  u32 pixel = PACK_COL(col);
+  if (textured)
+    pixel = shade_texel(setup, alpha, beta, gamma, pixel);
+  return pixel;
+}
+
+/*
+ * Fill a triangle one pixel at a time. Steps the edge functions as i64, so
+ * it also takes the triangles too large for the SIMD kernels.
+ */
+static ALWAYS_INLINE void fill_scalar(const target_t *target,
+                                      const tri_setup_t *setup,
+                                      raster_stats_t *stats, fill_mode_t mode,
+                                      shade_mode_t shade) {
+  u64 tested = 0, passed = 0;
+  edge_t e0 = setup->e0, e1 = setup->e1, e2 = setup->e2;
+  f32 inv_area = setup->inv_area;
+  /* The edges' offsets, as barycentric coordinates */
+  f32 a0 = e0.offset * inv_area, a1 = e1.offset * inv_area;
+  f32 a2 = e2.offset * inv_area;
+  f32 z0 = setup->z0, z1 = setup->z1, z2 = setup->z2;
+  bool depth_only = mode == FILL_DEPTH;
+  bool depth_equal = mode == FILL_EQUAL;
+  bool write_ids = shade == SHADE_IDS && !depth_only;
+  bool write_color = shade != SHADE_IDS && !depth_only;
+
+  /* Loop over bounding box */
+  u32 *color_row = target->color + (setup->min_y * target->width);
+  f32 *depth_row = target->depth + (setup->min_y * target->width);
+  u32 *ids_row =
+      write_ids ? target->ids + (setup->min_y * target->width) : NULL;
+  for (i32 y = setup->min_y; y < setup->max_y; y++) {
+    /* Step the edge functions along the row */
+    i64 w0 = e0.row;
+    i64 w1 = e1.row;
+    i64 w2 = e2.row;
+    for (i32 x = setup->min_x; x < setup->max_x; x++) {
+      /* Is it a point in the triangle? */
+      if ((w0 | w1 | w2) >= 0) {
+        tested++;
+        /* Find barycentric coordinates */
+        f32 alpha = (f32)w0 * inv_area + a0;
+        f32 beta = (f32)w1 * inv_area + a1;
+        f32 gamma = (f32)w2 * inv_area + a2;
+
+        /* Interpolation - z */
+        f32 z = alpha * z0 + beta * z1 + gamma * z2;
+
+        /* Draw pixel */
+        if (depth_equal ? z <= depth_row[x] * DEPTH_EQUAL_SCALE
+                        : z < depth_row[x]) {
+          /*
+           * Draw pixel to screen, or leave it to resolverect() or to the
+           * pass after a depth pre-pass
+           */
+          if (write_ids)
+            ids_row[x] = setup->id;
+          else if (write_color)
+            color_row[x] = shade_pixel(setup, alpha, beta, gamma,
+                                       shade == SHADE_TEXTURED);
+          /* Update z buffer, unless it already holds z */
+          if (!depth_equal)
+            depth_row[x] = z;
+          passed++;
+        }
+      }
+      w0 += e0.step_x;
+      w1 += e1.step_x;
+      w2 += e2.step_x;
+    }
+    /* Step the edge functions down a row */
+    e0.row += e0.step_y;
+    e1.row += e1.step_y;
+    e2.row += e2.step_y;
+    color_row += target->width;
+    depth_row += target->width;
+    if (write_ids)
+      ids_row += target->width;
+  }
+  stats->tested += tested;
+  stats->passed += passed;
+}
+KERNEL_VARIANTS(fill_scalar, )
+/* Shade a run of pixels of a triangle one at a time */
+static ALWAYS_INLINE void span_scalar(const tri_setup_t *setup, i64 w0,
+                                      i64 w1, i64 w2, i32 count, u32 *color,
+                                      shade_mode_t shade) {
+  f32 inv_area = setup->inv_area;
+  f32 a0 = setup->e0.offset * inv_area, a1 = setup->e1.offset * inv_area;
+  f32 a2 = setup->e2.offset * inv_area;
+  for (i32 i = 0; i < count; i++) {
+    color[i] = shade_pixel(setup, (f32)w0 * inv_area + a0,
+                           (f32)w1 * inv_area + a1, (f32)w2 * inv_area + a2,
+                           shade == SHADE_TEXTURED);
+    w0 += setup->e0.step_x;
+    w1 += setup->e1.step_x;
+    w2 += setup->e2.step_x;
+  }
+}
+SPAN_VARIANTS(span_scalar, )
+
+#if defined(RASTER_X86)
+/*
+ * Find the texture coordinates and mip level of four pixels from their
+ * barycentric coordinates, as shade_texel() does, leaving only the
+ * sampling to be done one pixel at a time
+ */
+__attribute__((target("sse2")))
+static inline void texcoords_sse2(const tri_setup_t *setup, __m128 alpha,
+                                  __m128 beta, __m128 gamma, f32 *u, f32 *v,
+                                  f32 *lod) {
+  /* Perspective correct texture coordinates */
+  __m128 q = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(alpha, _mm_set1_ps(setup->q0)),
+                 _mm_mul_ps(beta, _mm_set1_ps(setup->q1))),
+      _mm_mul_ps(gamma, _mm_set1_ps(setup->q2)));
+  __m128 inv_q = _mm_div_ps(_mm_set1_ps(1.0f), q);
+  __m128 uq = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(alpha, _mm_set1_ps(setup->uq0)),
+                 _mm_mul_ps(beta, _mm_set1_ps(setup->uq1))),
+      _mm_mul_ps(gamma, _mm_set1_ps(setup->uq2)));
+  __m128 vq = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(alpha, _mm_set1_ps(setup->vq0)),
+                 _mm_mul_ps(beta, _mm_set1_ps(setup->vq1))),
+      _mm_mul_ps(gamma, _mm_set1_ps(setup->vq2)));
+  __m128 tu = _mm_mul_ps(uq, inv_q), tv = _mm_mul_ps(vq, inv_q);
+  /* Their derivatives, and the mip level from the larger footprint */
+  __m128 q_dx = _mm_set1_ps(setup->q_dx), q_dy = _mm_set1_ps(setup->q_dy);
+  __m128 du_dx = _mm_mul_ps(
+      _mm_sub_ps(_mm_set1_ps(setup->uq_dx), _mm_mul_ps(tu, q_dx)), inv_q);
+  __m128 dv_dx = _mm_mul_ps(
+      _mm_sub_ps(_mm_set1_ps(setup->vq_dx), _mm_mul_ps(tv, q_dx)), inv_q);
+  __m128 du_dy = _mm_mul_ps(
+      _mm_sub_ps(_mm_set1_ps(setup->uq_dy), _mm_mul_ps(tu, q_dy)), inv_q);
+  __m128 dv_dy = _mm_mul_ps(
+      _mm_sub_ps(_mm_set1_ps(setup->vq_dy), _mm_mul_ps(tv, q_dy)), inv_q);
+  __m128 rho2 = _mm_max_ps(
+      _mm_add_ps(_mm_mul_ps(du_dx, du_dx), _mm_mul_ps(dv_dx, dv_dx)),
+      _mm_add_ps(_mm_mul_ps(du_dy, du_dy), _mm_mul_ps(dv_dy, dv_dy)));
+  __m128 level = _mm_mul_ps(
+      _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(rho2)),
+                            _mm_set1_ps(1.0f / (1 << 23))),
+                 _mm_set1_ps(127.0f)),
+      _mm_set1_ps(0.5f));
+  _mm_storeu_ps(u, tu);
+  _mm_storeu_ps(v, tv);
+  _mm_storeu_ps(lod, level);
+}
+/*
+ * Shade four pixels of a triangle from their barycentric coordinates, as
+ * shade_pixel() does, texturing the lanes set in a mask
+ */
+__attribute__((target("sse2")))
+static ALWAYS_INLINE __m128i shade_sse2(const tri_setup_t *setup, __m128 alpha,
+                                        __m128 beta, __m128 gamma, i32 lanes,
+                                        bool textured) {
+  const tri_col_t *cols = &setup->cols;
+  __m128 r0 = _mm_set1_ps(cols->c0.r), r1 = _mm_set1_ps(cols->c1.r);
+  __m128 r2 = _mm_set1_ps(cols->c2.r);
+  __m128 g0 = _mm_set1_ps(cols->c0.g), g1 = _mm_set1_ps(cols->c1.g);
+  __m128 g2 = _mm_set1_ps(cols->c2.g);
+  __m128 b0 = _mm_set1_ps(cols->c0.b), b1 = _mm_set1_ps(cols->c1.b);
+  __m128 b2 = _mm_set1_ps(cols->c2.b);
+  __m128 max_col = _mm_set1_ps(255.0f);
+  __m128i alpha_bits = _mm_set1_epi32(0xff);
+  /* Interpolation - col */
+  __m128 r = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(alpha, r0), _mm_mul_ps(beta, r1)),
+      _mm_mul_ps(gamma, r2));
+  __m128 g = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(alpha, g0), _mm_mul_ps(beta, g1)),
+      _mm_mul_ps(gamma, g2));
+  __m128 b = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(alpha, b0), _mm_mul_ps(beta, b1)),
+      _mm_mul_ps(gamma, b2));
+  __m128i ri = _mm_cvttps_epi32(_mm_min_ps(r, max_col));
+  __m128i gi = _mm_cvttps_epi32(_mm_min_ps(g, max_col));
+  __m128i bi = _mm_cvttps_epi32(_mm_min_ps(b, max_col));
+  __m128i pixel = _mm_or_si128(
+      _mm_or_si128(_mm_slli_epi32(ri, 24), _mm_slli_epi32(gi, 16)),
+      _mm_or_si128(_mm_slli_epi32(bi, 8), alpha_bits));
+  if (textured) {
+    /* Sample the texture one lane at a time */
+    f32 lane_u[4], lane_v[4], lane_lod[4];
+    u32 lane_pixel[4];
+    texcoords_sse2(setup, alpha, beta, gamma, lane_u, lane_v, lane_lod);
+    _mm_storeu_si128((__m128i *)lane_pixel, pixel);
+    for (i32 bits = lanes; bits; bits &= bits - 1) {
+      i32 i = __builtin_ctz(bits);
+      u32 texel = texture_sample(setup->texture, lane_u[i], lane_v[i],
+                                 lane_lod[i]);
+      lane_pixel[i] = modulate(texel, lane_pixel[i]);
+    }
+    pixel = _mm_loadu_si128((__m128i *)lane_pixel);
+  }
+  return pixel;
+}
+/*
+ * Fill a triangle in 4x1 pixel blocks with SSE2. Edge functions must stay
+ * within EDGE_LIMIT over the bounding box.
+ */
+__attribute__((target("sse2")))
+static ALWAYS_INLINE void fill_sse2(const target_t *target,
+                                    const tri_setup_t *setup,
+                                    raster_stats_t *stats, fill_mode_t mode,
+                                    shade_mode_t shade) {
+  u64 tested = 0, passed = 0;
+  /* Blocks start on 4 pixel boundaries, lanes outside the box are masked */
+  i32 start_x = setup->min_x & ~3;
+  i32 skip = start_x - setup->min_x;
+  __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+  __m128i min_x = _mm_set1_epi32(setup->min_x - 1);
+  __m128i max_x = _mm_set1_epi32(setup->max_x);
+  /* Per lane edge offsets and per block steps */
+  i32 e0_row = (i32)setup->e0.row + skip * setup->e0.step_x;
+  i32 e1_row = (i32)setup->e1.row + skip * setup->e1.step_x;
+  i32 e2_row = (i32)setup->e2.row + skip * setup->e2.step_x;
+  __m128i e0_off = _mm_setr_epi32(
+      0, setup->e0.step_x, 2 * setup->e0.step_x, 3 * setup->e0.step_x);
+  __m128i e1_off = _mm_setr_epi32(
+      0, setup->e1.step_x, 2 * setup->e1.step_x, 3 * setup->e1.step_x);
+  __m128i e2_off = _mm_setr_epi32(
+      0, setup->e2.step_x, 2 * setup->e2.step_x, 3 * setup->e2.step_x);
+  __m128i e0_step = _mm_set1_epi32(4 * setup->e0.step_x);
+  __m128i e1_step = _mm_set1_epi32(4 * setup->e1.step_x);
+  __m128i e2_step = _mm_set1_epi32(4 * setup->e2.step_x);
+  /* Interpolation constants */
+  __m128 inv_area = _mm_set1_ps(setup->inv_area);
+  /* The edges' offsets, as barycentric coordinates */
+  __m128 a0 = _mm_set1_ps(setup->e0.offset * setup->inv_area);
+  __m128 a1 = _mm_set1_ps(setup->e1.offset * setup->inv_area);
+  __m128 a2 = _mm_set1_ps(setup->e2.offset * setup->inv_area);
+  __m128 z0 = _mm_set1_ps(setup->z0);
+  __m128 z1 = _mm_set1_ps(setup->z1);
+  __m128 z2 = _mm_set1_ps(setup->z2);
+  __m128 equal_scale = _mm_set1_ps(DEPTH_EQUAL_SCALE);
+  __m128i id = _mm_set1_epi32(setup->id);
+  bool depth_only = mode == FILL_DEPTH;
+  bool depth_equal = mode == FILL_EQUAL;
+  bool write_ids = shade == SHADE_IDS && !depth_only;
+  bool write_color = shade != SHADE_IDS && !depth_only;
+
+  /* Loop over bounding box */
+  u32 *color_row = target->color + (setup->min_y * target->width);
+  f32 *depth_row = target->depth + (setup->min_y * target->width);
+  u32 *ids_row =
+      write_ids ? target->ids + (setup->min_y * target->width) : NULL;
+  for (i32 y = setup->min_y; y < setup->max_y; y++) {
+    __m128i w0 = _mm_add_epi32(_mm_set1_epi32(e0_row), e0_off);
+    __m128i w1 = _mm_add_epi32(_mm_set1_epi32(e1_row), e1_off);
+    __m128i w2 = _mm_add_epi32(_mm_set1_epi32(e2_row), e2_off);
+    for (i32 x = start_x; x < setup->max_x; x += 4) {
+      /* Coverage: inside all three edges and inside the bounding box */
+      __m128i xs = _mm_add_epi32(_mm_set1_epi32(x), lane);
+      __m128i inside = _mm_cmpgt_epi32(
+          _mm_or_si128(_mm_or_si128(w0, w1), w2), _mm_set1_epi32(-1));
+      inside = _mm_and_si128(inside, _mm_cmpgt_epi32(xs, min_x));
+      inside = _mm_and_si128(inside, _mm_cmplt_epi32(xs, max_x));
+      if (_mm_movemask_epi8(inside) != 0) {
+        if (x + 4 > target->width) {
+          /* Block hangs off the right of the target - finish in scalar */
+          tri_setup_t tail = *setup;
+          tail.min_x = MAX(x, setup->min_x);
+          tail.min_y = y;
+          tail.max_y = y + 1;
+          i32 skip_tail = tail.min_x - x;
+          tail.e0.row = _mm_cvtsi128_si32(w0) + skip_tail * setup->e0.step_x;
+          tail.e1.row = _mm_cvtsi128_si32(w1) + skip_tail * setup->e1.step_x;
+          tail.e2.row = _mm_cvtsi128_si32(w2) + skip_tail * setup->e2.step_x;
+          fill_scalar(target, &tail, stats, mode, shade);
+          break;
+        }
+        /* Find barycentric coordinates */
+        __m128 alpha =
+            _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(w0), inv_area), a0);
+        __m128 beta =
+            _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(w1), inv_area), a1);
+        __m128 gamma =
+            _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(w2), inv_area), a2);
+        /* Interpolation - z */
+        __m128 z = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(alpha, z0), _mm_mul_ps(beta, z1)),
+            _mm_mul_ps(gamma, z2));
+        /* Depth test */
+        __m128 old_z = _mm_loadu_ps(depth_row + x);
+        __m128 nearer =
+            depth_equal ? _mm_cmple_ps(z, _mm_mul_ps(old_z, equal_scale))
+                        : _mm_cmplt_ps(z, old_z);
+        __m128i pass = _mm_and_si128(inside, _mm_castps_si128(nearer));
+        i32 pass_bits = _mm_movemask_ps(_mm_castsi128_ps(pass));
+        tested += __builtin_popcount(
+            _mm_movemask_ps(_mm_castsi128_ps(inside)));
+        if (pass_bits != 0) {
+          passed += __builtin_popcount(pass_bits);
+          if (write_ids) {
+            /* Masked write of the id, leaving shading to resolverect() */
+            __m128i *ids_ptr = (__m128i *)(ids_row + x);
+            __m128i old_ids = _mm_loadu_si128(ids_ptr);
+            _mm_storeu_si128(ids_ptr, _mm_or_si128(
+                _mm_and_si128(pass, id), _mm_andnot_si128(pass, old_ids)));
+          } else if (write_color) {
+            __m128i pixel = shade_sse2(setup, alpha, beta, gamma, pass_bits,
+                                       shade == SHADE_TEXTURED);
+            /* Masked write of color */
+            __m128i *color_ptr = (__m128i *)(color_row + x);
+            __m128i old_col = _mm_loadu_si128(color_ptr);
+            _mm_storeu_si128(color_ptr, _mm_or_si128(
+                _mm_and_si128(pass, pixel), _mm_andnot_si128(pass, old_col)));
+          }
+          /* Masked write of depth, unless it already holds z */
+          __m128 pass_ps = _mm_castsi128_ps(pass);
+          if (!depth_equal)
+            _mm_storeu_ps(depth_row + x, _mm_or_ps(
+                _mm_and_ps(pass_ps, z), _mm_andnot_ps(pass_ps, old_z)));
+        }
+      }
+      w0 = _mm_add_epi32(w0, e0_step);
+      w1 = _mm_add_epi32(w1, e1_step);
+      w2 = _mm_add_epi32(w2, e2_step);
+    }
+    /* Step the edge functions down a row */
+    e0_row += setup->e0.step_y;
+    e1_row += setup->e1.step_y;
+    e2_row += setup->e2.step_y;
+    color_row += target->width;
+    depth_row += target->width;
+    if (write_ids)
+      ids_row += target->width;
+  }
+  stats->tested += tested;
+  stats->passed += passed;
+}
+KERNEL_VARIANTS(fill_sse2, __attribute__((target("sse2"))))
+
+/* Find the texture coordinates and mip level of eight pixels, see above */
+__attribute__((target("avx2")))
+static inline void texcoords_avx2(const tri_setup_t *setup, __m256 alpha,
+                                  __m256 beta, __m256 gamma, f32 *u, f32 *v,
+                                  f32 *lod) {
+  /* Perspective correct texture coordinates */
+  __m256 q = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(alpha, _mm256_set1_ps(setup->q0)),
+                    _mm256_mul_ps(beta, _mm256_set1_ps(setup->q1))),
+      _mm256_mul_ps(gamma, _mm256_set1_ps(setup->q2)));
+  __m256 inv_q = _mm256_div_ps(_mm256_set1_ps(1.0f), q);
+  __m256 uq = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(alpha, _mm256_set1_ps(setup->uq0)),
+                    _mm256_mul_ps(beta, _mm256_set1_ps(setup->uq1))),
+      _mm256_mul_ps(gamma, _mm256_set1_ps(setup->uq2)));
+  __m256 vq = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(alpha, _mm256_set1_ps(setup->vq0)),
+                    _mm256_mul_ps(beta, _mm256_set1_ps(setup->vq1))),
+      _mm256_mul_ps(gamma, _mm256_set1_ps(setup->vq2)));
+  __m256 tu = _mm256_mul_ps(uq, inv_q), tv = _mm256_mul_ps(vq, inv_q);
+  /* Their derivatives, and the mip level from the larger footprint */
+  __m256 q_dx = _mm256_set1_ps(setup->q_dx);
+  __m256 q_dy = _mm256_set1_ps(setup->q_dy);
+  __m256 du_dx = _mm256_mul_ps(
+      _mm256_sub_ps(_mm256_set1_ps(setup->uq_dx), _mm256_mul_ps(tu, q_dx)),
+      inv_q);
+  __m256 dv_dx = _mm256_mul_ps(
+      _mm256_sub_ps(_mm256_set1_ps(setup->vq_dx), _mm256_mul_ps(tv, q_dx)),
+      inv_q);
+  __m256 du_dy = _mm256_mul_ps(
+      _mm256_sub_ps(_mm256_set1_ps(setup->uq_dy), _mm256_mul_ps(tu, q_dy)),
+      inv_q);
+  __m256 dv_dy = _mm256_mul_ps(
+      _mm256_sub_ps(_mm256_set1_ps(setup->vq_dy), _mm256_mul_ps(tv, q_dy)),
+      inv_q);
+  __m256 rho2 = _mm256_max_ps(
+      _mm256_add_ps(_mm256_mul_ps(du_dx, du_dx), _mm256_mul_ps(dv_dx, dv_dx)),
+      _mm256_add_ps(_mm256_mul_ps(du_dy, du_dy), _mm256_mul_ps(dv_dy, dv_dy)));
+  __m256 level = _mm256_mul_ps(
+      _mm256_sub_ps(
+          _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_castps_si256(rho2)),
+                        _mm256_set1_ps(1.0f / (1 << 23))),
+          _mm256_set1_ps(127.0f)),
+      _mm256_set1_ps(0.5f));
+  _mm256_storeu_ps(u, tu);
+  _mm256_storeu_ps(v, tv);
+  _mm256_storeu_ps(lod, level);
+}
+/* Shade eight pixels of a triangle, see above */
+__attribute__((target("avx2")))
+static ALWAYS_INLINE __m256i shade_avx2(const tri_setup_t *setup, __m256 alpha,
+                                        __m256 beta, __m256 gamma, i32 lanes,
+                                        bool textured) {
+  const tri_col_t *cols = &setup->cols;
+  __m256 r0 = _mm256_set1_ps(cols->c0.r), r1 = _mm256_set1_ps(cols->c1.r);
+  __m256 r2 = _mm256_set1_ps(cols->c2.r);
+  __m256 g0 = _mm256_set1_ps(cols->c0.g), g1 = _mm256_set1_ps(cols->c1.g);
+  __m256 g2 = _mm256_set1_ps(cols->c2.g);
+  __m256 b0 = _mm256_set1_ps(cols->c0.b), b1 = _mm256_set1_ps(cols->c1.b);
+  __m256 b2 = _mm256_set1_ps(cols->c2.b);
+  __m256 max_col = _mm256_set1_ps(255.0f);
+  __m256i alpha_bits = _mm256_set1_epi32(0xff);
+  /* Interpolation - col */
+  __m256 r = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(alpha, r0), _mm256_mul_ps(beta, r1)),
+      _mm256_mul_ps(gamma, r2));
+  __m256 g = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(alpha, g0), _mm256_mul_ps(beta, g1)),
+      _mm256_mul_ps(gamma, g2));
+  __m256 b = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(alpha, b0), _mm256_mul_ps(beta, b1)),
+      _mm256_mul_ps(gamma, b2));
+  __m256i ri = _mm256_cvttps_epi32(_mm256_min_ps(r, max_col));
+  __m256i gi = _mm256_cvttps_epi32(_mm256_min_ps(g, max_col));
+  __m256i bi = _mm256_cvttps_epi32(_mm256_min_ps(b, max_col));
+  __m256i pixel = _mm256_or_si256(
+      _mm256_or_si256(
+          _mm256_slli_epi32(ri, 24), _mm256_slli_epi32(gi, 16)),
+      _mm256_or_si256(_mm256_slli_epi32(bi, 8), alpha_bits));
+  if (textured) {
+    /* Sample the texture one lane at a time */
+    f32 lane_u[8], lane_v[8], lane_lod[8];
+    u32 lane_pixel[8];
+    texcoords_avx2(setup, alpha, beta, gamma, lane_u, lane_v, lane_lod);
+    _mm256_storeu_si256((__m256i *)lane_pixel, pixel);
+    for (i32 bits = lanes; bits; bits &= bits - 1) {
+      i32 i = __builtin_ctz(bits);
+      u32 texel = texture_sample(setup->texture, lane_u[i], lane_v[i],
+                                 lane_lod[i]);
+      lane_pixel[i] = modulate(texel, lane_pixel[i]);
+    }
+    pixel = _mm256_loadu_si256((__m256i *)lane_pixel);
+  }
+  return pixel;
+}
+/*
+ * Shade a run of pixels of a triangle in 4x1 pixel blocks with SSE2. Edge
+ * functions must stay within EDGE_LIMIT along it.
+ */
+__attribute__((target("sse2")))
+static ALWAYS_INLINE void span_sse2(const tri_setup_t *setup, i64 w0,
+                                    i64 w1, i64 w2, i32 count, u32 *color,
+                                    shade_mode_t shade) {
+  __m128i e0 = _mm_add_epi32(_mm_set1_epi32((i32)w0), _mm_setr_epi32(
+      0, setup->e0.step_x, 2 * setup->e0.step_x, 3 * setup->e0.step_x));
+  __m128i e1 = _mm_add_epi32(_mm_set1_epi32((i32)w1), _mm_setr_epi32(
+      0, setup->e1.step_x, 2 * setup->e1.step_x, 3 * setup->e1.step_x));
+  __m128i e2 = _mm_add_epi32(_mm_set1_epi32((i32)w2), _mm_setr_epi32(
+      0, setup->e2.step_x, 2 * setup->e2.step_x, 3 * setup->e2.step_x));
+  __m128i e0_step = _mm_set1_epi32(4 * setup->e0.step_x);
+  __m128i e1_step = _mm_set1_epi32(4 * setup->e1.step_x);
+  __m128i e2_step = _mm_set1_epi32(4 * setup->e2.step_x);
+  __m128 inv_area = _mm_set1_ps(setup->inv_area);
+  /* The edges' offsets, as barycentric coordinates */
+  __m128 a0 = _mm_set1_ps(setup->e0.offset * setup->inv_area);
+  __m128 a1 = _mm_set1_ps(setup->e1.offset * setup->inv_area);
+  __m128 a2 = _mm_set1_ps(setup->e2.offset * setup->inv_area);
+  for (i32 i = 0; i < count; i += 4) {
+    __m128 alpha =
+        _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(e0), inv_area), a0);
+    __m128 beta =
+        _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(e1), inv_area), a1);
+    __m128 gamma =
+        _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(e2), inv_area), a2);
+    i32 lanes = count - i >= 4 ? 0xf : (1 << (count - i)) - 1;
+    __m128i pixel = shade_sse2(setup, alpha, beta, gamma, lanes,
+                               shade == SHADE_TEXTURED);
+    if (lanes == 0xf) {
+      _mm_storeu_si128((__m128i *)(color + i), pixel);
+    } else {
+      u32 lane_pixel[4];
+      _mm_storeu_si128((__m128i *)lane_pixel, pixel);
+      memcpy(color + i, lane_pixel, sizeof(u32) * (count - i));
+    }
+    e0 = _mm_add_epi32(e0, e0_step);
+    e1 = _mm_add_epi32(e1, e1_step);
+    e2 = _mm_add_epi32(e2, e2_step);
+  }
+}
+SPAN_VARIANTS(span_sse2, __attribute__((target("sse2"))))
+/*
+ * Fill a triangle in 8x1 pixel blocks with AVX2. Edge functions must stay
+ * within EDGE_LIMIT over the bounding box.
+ */
+__attribute__((target("avx2")))
+static ALWAYS_INLINE void fill_avx2(const target_t *target,
+                                    const tri_setup_t *setup,
+                                    raster_stats_t *stats, fill_mode_t mode,
+                                    shade_mode_t shade) {
+  u64 tested = 0, passed = 0;
+  /* Blocks start on 8 pixel boundaries, lanes outside the box are masked */
+  i32 start_x = setup->min_x & ~7;
+  i32 skip = start_x - setup->min_x;
+  __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i min_x = _mm256_set1_epi32(setup->min_x - 1);
+  __m256i max_x = _mm256_set1_epi32(setup->max_x);
+  /* Per lane edge offsets and per block steps */
+  i32 e0_row = (i32)setup->e0.row + skip * setup->e0.step_x;
+  i32 e1_row = (i32)setup->e1.row + skip * setup->e1.step_x;
+  i32 e2_row = (i32)setup->e2.row + skip * setup->e2.step_x;
+  __m256i e0_off =
+      _mm256_mullo_epi32(lane, _mm256_set1_epi32(setup->e0.step_x));
+  __m256i e1_off =
+      _mm256_mullo_epi32(lane, _mm256_set1_epi32(setup->e1.step_x));
+  __m256i e2_off =
+      _mm256_mullo_epi32(lane, _mm256_set1_epi32(setup->e2.step_x));
+  __m256i e0_step = _mm256_set1_epi32(8 * setup->e0.step_x);
+  __m256i e1_step = _mm256_set1_epi32(8 * setup->e1.step_x);
+  __m256i e2_step = _mm256_set1_epi32(8 * setup->e2.step_x);
+  /* Interpolation constants */
+  __m256 inv_area = _mm256_set1_ps(setup->inv_area);
+  /* The edges' offsets, as barycentric coordinates */
+  __m256 a0 = _mm256_set1_ps(setup->e0.offset * setup->inv_area);
+  __m256 a1 = _mm256_set1_ps(setup->e1.offset * setup->inv_area);
+  __m256 a2 = _mm256_set1_ps(setup->e2.offset * setup->inv_area);
+  __m256 z0 = _mm256_set1_ps(setup->z0);
+  __m256 z1 = _mm256_set1_ps(setup->z1);
+  __m256 z2 = _mm256_set1_ps(setup->z2);
+  __m256 equal_scale = _mm256_set1_ps(DEPTH_EQUAL_SCALE);
+  __m256i id = _mm256_set1_epi32(setup->id);
+  bool depth_only = mode == FILL_DEPTH;
+  bool depth_equal = mode == FILL_EQUAL;
+  bool write_ids = shade == SHADE_IDS && !depth_only;
+  bool write_color = shade != SHADE_IDS && !depth_only;
+
+  /* Loop over bounding box */
+  u32 *color_row = target->color + (setup->min_y * target->width);
+  f32 *depth_row = target->depth + (setup->min_y * target->width);
+  u32 *ids_row =
+      write_ids ? target->ids + (setup->min_y * target->width) : NULL;
+  for (i32 y = setup->min_y; y < setup->max_y; y++) {
+    __m256i w0 = _mm256_add_epi32(_mm256_set1_epi32(e0_row), e0_off);
+    __m256i w1 = _mm256_add_epi32(_mm256_set1_epi32(e1_row), e1_off);
+    __m256i w2 = _mm256_add_epi32(_mm256_set1_epi32(e2_row), e2_off);
+    for (i32 x = start_x; x < setup->max_x; x += 8) {
+      /* Coverage: inside all three edges and inside the bounding box */
+      __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+      __m256i inside = _mm256_cmpgt_epi32(
+          _mm256_or_si256(_mm256_or_si256(w0, w1), w2),
+          _mm256_set1_epi32(-1));
+      inside = _mm256_and_si256(inside, _mm256_cmpgt_epi32(xs, min_x));
+      inside = _mm256_and_si256(inside, _mm256_cmpgt_epi32(max_x, xs));
+      if (!_mm256_testz_si256(inside, inside)) {
+        /* Find barycentric coordinates */
+        __m256 alpha = _mm256_add_ps(
+            _mm256_mul_ps(_mm256_cvtepi32_ps(w0), inv_area), a0);
+        __m256 beta = _mm256_add_ps(
+            _mm256_mul_ps(_mm256_cvtepi32_ps(w1), inv_area), a1);
+        __m256 gamma = _mm256_add_ps(
+            _mm256_mul_ps(_mm256_cvtepi32_ps(w2), inv_area), a2);
+        /* Interpolation - z */
+        __m256 z = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(alpha, z0), _mm256_mul_ps(beta, z1)),
+            _mm256_mul_ps(gamma, z2));
+        /* Depth test, masked so nothing outside the box is touched */
+        __m256 old_z = _mm256_maskload_ps(depth_row + x, inside);
+        __m256 nearer =
+            depth_equal ? _mm256_cmp_ps(z, _mm256_mul_ps(old_z, equal_scale),
+                                        _CMP_LE_OQ)
+                        : _mm256_cmp_ps(z, old_z, _CMP_LT_OQ);
+        __m256i pass = _mm256_and_si256(inside, _mm256_castps_si256(nearer));
+        i32 pass_bits = _mm256_movemask_ps(_mm256_castsi256_ps(pass));
+        tested += __builtin_popcount(
+            _mm256_movemask_ps(_mm256_castsi256_ps(inside)));
+        if (pass_bits != 0) {
+          passed += __builtin_popcount(pass_bits);
+          if (write_ids) {
+            /* Masked write of the id, leaving shading to resolverect() */
+            _mm256_maskstore_epi32((int *)(ids_row + x), pass, id);
+          } else if (write_color) {
+            __m256i pixel = shade_avx2(setup, alpha, beta, gamma, pass_bits,
+                                       shade == SHADE_TEXTURED);
+            /* Masked write of color */
+            _mm256_maskstore_epi32((int *)(color_row + x), pass, pixel);
+          }
+          /* Masked write of depth, unless it already holds z */
+          if (!depth_equal)
+            _mm256_maskstore_ps(depth_row + x, pass, z);
+        }
+      }
+      w0 = _mm256_add_epi32(w0, e0_step);
+      w1 = _mm256_add_epi32(w1, e1_step);
+      w2 = _mm256_add_epi32(w2, e2_step);
+    }
+    /* Step the edge functions down a row */
+    e0_row += setup->e0.step_y;
+    e1_row += setup->e1.step_y;
+    e2_row += setup->e2.step_y;
+    color_row += target->width;
+    depth_row += target->width;
+    if (write_ids)
+      ids_row += target->width;
+  }
+  stats->tested += tested;
+  stats->passed += passed;
+}
+KERNEL_VARIANTS(fill_avx2, __attribute__((target("avx2"))))
+/* Shade a run of pixels of a triangle in 8x1 pixel blocks with AVX2 */
+__attribute__((target("avx2")))
+static ALWAYS_INLINE void span_avx2(const tri_setup_t *setup, i64 w0,
+                                    i64 w1, i64 w2, i32 count, u32 *color,
+                                    shade_mode_t shade) {
+  __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i e0 = _mm256_add_epi32(
+      _mm256_set1_epi32((i32)w0),
+      _mm256_mullo_epi32(lane, _mm256_set1_epi32(setup->e0.step_x)));
+  __m256i e1 = _mm256_add_epi32(
+      _mm256_set1_epi32((i32)w1),
+      _mm256_mullo_epi32(lane, _mm256_set1_epi32(setup->e1.step_x)));
+  __m256i e2 = _mm256_add_epi32(
+      _mm256_set1_epi32((i32)w2),
+      _mm256_mullo_epi32(lane, _mm256_set1_epi32(setup->e2.step_x)));
+  __m256i e0_step = _mm256_set1_epi32(8 * setup->e0.step_x);
+  __m256i e1_step = _mm256_set1_epi32(8 * setup->e1.step_x);
+  __m256i e2_step = _mm256_set1_epi32(8 * setup->e2.step_x);
+  __m256 inv_area = _mm256_set1_ps(setup->inv_area);
+  /* The edges' offsets, as barycentric coordinates */
+  __m256 a0 = _mm256_set1_ps(setup->e0.offset * setup->inv_area);
+  __m256 a1 = _mm256_set1_ps(setup->e1.offset * setup->inv_area);
+  __m256 a2 = _mm256_set1_ps(setup->e2.offset * setup->inv_area);
+  for (i32 i = 0; i < count; i += 8) {
+    __m256 alpha = _mm256_add_ps(
+        _mm256_mul_ps(_mm256_cvtepi32_ps(e0), inv_area), a0);
+    __m256 beta = _mm256_add_ps(
+        _mm256_mul_ps(_mm256_cvtepi32_ps(e1), inv_area), a1);
+    __m256 gamma = _mm256_add_ps(
+        _mm256_mul_ps(_mm256_cvtepi32_ps(e2), inv_area), a2);
+    i32 lanes = count - i >= 8 ? 0xff : (1 << (count - i)) - 1;
+    __m256i pixel = shade_avx2(setup, alpha, beta, gamma, lanes,
+                               shade == SHADE_TEXTURED);
+    if (lanes == 0xff) {
+      _mm256_storeu_si256((__m256i *)(color + i), pixel);
+    } else {
+      __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(count - i), lane);
+      _mm256_maskstore_epi32((int *)(color + i), mask, pixel);
+    }
+    e0 = _mm256_add_epi32(e0, e0_step);
+    e1 = _mm256_add_epi32(e1, e1_step);
+    e2 = _mm256_add_epi32(e2, e2_step);
+  }
+}
+SPAN_VARIANTS(span_avx2, __attribute__((target("avx2"))))
+#endif /* RASTER_X86 */
+
+/*
+ * Kernel table, by kernel, fill mode and shade mode, NULL where unavailable
+ * on this architecture
+ */
+static const kernel_fn_t kernels[RASTER_COUNT][FILL_COUNT][SHADE_COUNT] = {
+    [RASTER_SCALAR] = KERNEL_TABLE(fill_scalar),
+#if defined(RASTER_X86)
+    [RASTER_SSE2] = KERNEL_TABLE(fill_sse2),
+    [RASTER_AVX2] = KERNEL_TABLE(fill_avx2),
+#endif
+};
+/*
+ * Their shading of runs of pixels from a visibility buffer, by whether
+ * textured (SHADE_COLOR or SHADE_TEXTURED)
+ */
+static const span_fn_t spans[RASTER_COUNT][2] = {
+    [RASTER_SCALAR] = SPAN_TABLE(span_scalar),
+#if defined(RASTER_X86)
+    [RASTER_SSE2] = SPAN_TABLE(span_sse2),
+    [RASTER_AVX2] = SPAN_TABLE(span_avx2),
+#endif
+};
+static const char *kernel_names[RASTER_COUNT] = {
+    [RASTER_SCALAR] = "scalar",
+    [RASTER_SSE2] = "sse2",
+    [RASTER_AVX2] = "avx2",
+};
+/* Kernel in use */
+static raster_kernel_t current_kernel = RASTER_SCALAR;
+
+/* Is a kernel built in and supported by the CPU (checked via CPUID)? */
+static bool kernel_supported(raster_kernel_t kernel) {
+  if (kernel >= RASTER_COUNT || !kernels[kernel][FILL_COLOR][SHADE_COLOR])
+    return false;
+  switch (kernel) {
+  case RASTER_SSE2:
+    return SDL_HasSSE2();
+  case RASTER_AVX2:
+    return SDL_HasAVX2();
+  default:
+    return true;
+  }
+}
+
+#if defined(RASTER_X86)
+/*
+ * Fill count u32s with a value using non-temporal SSE2 stores. They must
+ * be fenced with _mm_sfence() before another thread reads the memory.
+ */
+__attribute__((target("sse2")))
+static void stream_fill_sse2(u32 *dst, u32 value, u64 count) {
+  u64 i = 0;
+  /*
+   * Only whole cache lines are streamed, as partly written ones are slow
+   * to flush. Plain stores take the ends.
+   */
+  for (; i < count && ((uintptr_t)&dst[i] & 63); i++) {
+    dst[i] = value;
+  }
+  __m128i values = _mm_set1_epi32((i32)value);
+  for (; i + 16 <= count; i += 16) {
+    _mm_stream_si128((__m128i *)&dst[i], values);
+    _mm_stream_si128((__m128i *)&dst[i + 4], values);
+    _mm_stream_si128((__m128i *)&dst[i + 8], values);
+    _mm_stream_si128((__m128i *)&dst[i + 12], values);
+  }
+  for (; i < count; i++) {
+    dst[i] = value;
+  }
+}
+#endif
+/*
+ * Fill count u32s with a value. With a SIMD kernel the stores bypass the
+ * cache, for memory that won't be read again before it would be evicted,
+ * and must be followed by stream_fence().
+ */
+static void stream_fill(u32 *dst, u32 value, u64 count) {
+#if defined(RASTER_X86)
+  if (current_kernel != RASTER_SCALAR) {
+    stream_fill_sse2(dst, value, count);
+    return;
+  }
+#endif
+  for (u64 i = 0; i < count; i++) {
+    dst[i] = value;
+  }
+}
+/* Make the stores of stream_fill() visible to other threads */
+static void stream_fence(void) {
+#if defined(RASTER_X86)
+  if (current_kernel != RASTER_SCALAR)
+    _mm_sfence();
+#endif
+}
+
+/* Pick the fastest kernel the CPU supports */
+void raster_init(void) {
+  for (i32 kernel = RASTER_COUNT - 1; kernel >= 0; kernel--) {
+    if (kernel_supported(kernel)) {
+      current_kernel = kernel;
+      return;
+    }
+  }
+}
+/* Use a specific kernel, returns false if the CPU doesn't support it */
+bool raster_set_kernel(raster_kernel_t kernel) {
+  if (!kernel_supported(kernel))
+    return false;
+  current_kernel = kernel;
+  return true;
+}
+/* Get the kernel in use */
+raster_kernel_t raster_get_kernel(void) {
+  return current_kernel;
+}
+/* Get the name of a kernel */
+const char *raster_kernel_name(raster_kernel_t kernel) {
+  return kernel < RASTER_COUNT ? kernel_names[kernel] : "unknown";
+}
+
+/* Allocate the buffers of a render target in one block of memory */
+void *alloctarget(target_t *target, u64 pixels, u64 blocks) {
+  u64 color_size = (sizeof(u32) * pixels + TARGET_ALIGN - 1)
+                   & ~(u64)(TARGET_ALIGN - 1);
+  u64 depth_size = (sizeof(f32) * pixels + TARGET_ALIGN - 1)
+                   & ~(u64)(TARGET_ALIGN - 1);
+  u8 *memory = malloc(
+      TARGET_ALIGN - 1 + color_size + depth_size + sizeof(f32) * blocks
+  );
+  if (!memory)
+    return NULL;
+  u8 *base = (u8 *)(((uintptr_t)memory + TARGET_ALIGN - 1)
+                    & ~(uintptr_t)(TARGET_ALIGN - 1));
+  target->color = (u32 *)base;
+  target->depth = (f32 *)(base + color_size);
+  target->coarse = (f32 *)(base + color_size + depth_size);
+  return memory;
+}
+/* Clear the color buffer of a render target */
+void clearscreen(const target_t *target, col_t col) {
+  u32 pixel = PACK_COL(col);
+  for (u64 i = 0; i < (u64)target->width * target->height; i++) {
+    target->color[i] = pixel;
+  }
+}
+/* Clear a render target's color, depth and coarse depth */
+void cleartarget(const target_t *target, col_t col) {
+  union {
+    f32 f;
+    u32 u;
+  } far = {INFINITY};
+  u64 pixels = (u64)target->width * target->height;
+  stream_fill(target->color, PACK_COL(col), pixels);
+  stream_fill((u32 *)target->depth, far.u, pixels);
+  if (target->coarse) {
+    u64 blocks = (u64)HIZ_SIZE(target->width) * HIZ_SIZE(target->height);
+    stream_fill((u32 *)target->coarse, far.u, blocks);
+  }
+  stream_fence();
+}
+/* Clear the color, depth and coarse depth of a rectangle */
+void clearrect(const target_t *target, rect_t rect, col_t col,
+               bool streaming) {
+  union {
+    f32 f;
+    u32 u;
+  } far = {INFINITY};
+  u32 pixel = PACK_COL(col);
+  i32 width = rect.max_x - rect.min_x;
+  for (i32 y = rect.min_y; y < rect.max_y; y++) {
+    u32 *color = target->color + ((u64)y * target->width) + rect.min_x;
+    u32 *depth = (u32 *)target->depth + ((u64)y * target->width) + rect.min_x;
+    if (streaming) {
+      stream_fill(color, pixel, width);
+      stream_fill(depth, far.u, width);
+      continue;
+    }
+    for (i32 x = 0; x < width; x++) {
+      color[x] = pixel;
+      depth[x] = far.u;
+    }
+  }
+  if (streaming)
+    stream_fence();
+  if (!target->coarse)
+    return;
+  i32 blocks_x = HIZ_SIZE(target->width);
+  for (i32 by = rect.min_y / HIZ_BLOCK; by < HIZ_SIZE(rect.max_y); by++) {
+    for (i32 bx = rect.min_x / HIZ_BLOCK; bx < HIZ_SIZE(rect.max_x); bx++) {
+      target->coarse[(by * blocks_x) + bx] = INFINITY;
+    }
+  }
+}
+/* Write one pixel to a render target */
+void putpixel(const target_t *target, u32 x, u32 y, col_t col) {
+  if (x >= (u32)target->width || y >= (u32)target->height)
+    return;
+  target->color[(y * target->width) + x] = PACK_COL(col);
+}
+/* Write a line to a render target (Bresenham) */
+void putline(const target_t *target, i32 x0, i32 y0, i32 x1, i32 y1,
+             col_t col) {
+  i32 dx = abs(x1 - x0);
+  i32 dy = -abs(y1 - y0);
+  i32 sx = x0 < x1 ? 1 : -1;
+  i32 sy = y0 < y1 ? 1 : -1;
+  i32 err = dx + dy;
+  while (true) {
+    putpixel(target, x0, y0, col);
+    if (x0 == x1 && y0 == y1)
+      break;
+    i32 err2 = 2 * err;
+    if (err2 >= dy) {
+      err += dy;
+      x0 += sx;
+    }
+    if (err2 <= dx) {
+      err += dx;
+      y0 += sy;
+    }
+  }
+}
+/* Snap a screen space position to the fixed point grid */
+static inline vec2_int_t snap(vec3_t v) {
+  return (vec2_int_t){
+      floor_to_int(v.x * SUBPIXEL_ONE + 0.5f),
+      floor_to_int(v.y * SUBPIXEL_ONE + 0.5f),
+  };
+}
+/*
+ * Set up a screen space triangle, returns false if it covers no pixels.
+ * Vertices must be within GUARD_BAND pixels of the target.
+ */
+bool setuptri(const target_t *target, tri_t tri, tri_col_t cols,
+              const tri_tex_t *tex, tri_setup_t *setup) {
+  vec2_int_t v0 = snap(tri.v0);
+  vec2_int_t v1 = snap(tri.v1);
+  vec2_int_t v2 = snap(tri.v2);
+  setup->z0 = tri.v0.z;
+  setup->z1 = tri.v1.z;
+  setup->z2 = tri.v2.z;
+  setup->cols = cols;
+  setup->texture = NULL;
+  /*
+   * Get bounding box of the pixels whose centres the triangle may cover,
+   * clamped to the target. A pixel x has its centre at x + 0.5.
+   */
+  const i32 half = SUBPIXEL_ONE / 2;
+  i32 lo_x = MIN(MIN(v0.x, v1.x), v2.x), hi_x = MAX(MAX(v0.x, v1.x), v2.x);
+  i32 lo_y = MIN(MIN(v0.y, v1.y), v2.y), hi_y = MAX(MAX(v0.y, v1.y), v2.y);
+  setup->min_x = MAX(floor_pixel(lo_x + half - 1), 0);
+  setup->min_y = MAX(floor_pixel(lo_y + half - 1), 0);
+  setup->max_x = MIN(floor_pixel(hi_x - half) + 1, target->width);
+  setup->max_y = MIN(floor_pixel(hi_y - half) + 1, target->height);
+  if (setup->min_x >= setup->max_x || setup->min_y >= setup->max_y)
+    return false;
+
+  /* Ensure correct winding order */
+  i64 area = edge_function(v0, v1, v2);
+  bool swapped = area < 0;
+  if (swapped) {
+    SWAP(v1, v0);
+    SWAP(setup->z1, setup->z0);
+    SWAP(setup->cols.c1, setup->cols.c0);
+    area = -area;
+  }
+  if (area == 0)
+    return false;
+  /* Edge functions are in 1/SUBPIXEL_ONE units of the area's */
+  setup->inv_area = (f32)SUBPIXEL_ONE / area;
+
+  /* Set up edge functions at the centre of the top left pixel of the box */
+  vec2_int_t origin = (vec2_int_t){
+      setup->min_x * SUBPIXEL_ONE + half, setup->min_y * SUBPIXEL_ONE + half,
+  };
+  setup->e0 = setup_edge(v1, v2, origin);
+  setup->e1 = setup_edge(v2, v0, origin);
+  setup->e2 = setup_edge(v0, v1, origin);
+
+  /* Depth range, widened to cover rounding in the interpolation */
+  f32 z_min = MIN(MIN(setup->z0, setup->z1), setup->z2);
+  f32 z_max = MAX(MAX(setup->z0, setup->z1), setup->z2);
+  setup->z_min = z_min - fabsf(z_min) * DEPTH_EPSILON;
+  setup->z_max = z_max + fabsf(z_max) * DEPTH_EPSILON;
+
+  /* Texture coordinates over w, in texels, and 1/w */
+  if (tex && tex->texture) {
+    const texture_t *texture = tex->texture;
+    tri_tex_t t = *tex;
+    if (swapped) {
+      SWAP(t.uv1, t.uv0);
+      SWAP(t.q1, t.q0);
+    }
+    setup->texture = texture;
+    setup->q0 = t.q0;
+    setup->q1 = t.q1;
+    setup->q2 = t.q2;
+    setup->uq0 = t.uv0.x * texture->width * t.q0;
+    setup->uq1 = t.uv1.x * texture->width * t.q1;
+    setup->uq2 = t.uv2.x * texture->width * t.q2;
+    setup->vq0 = t.uv0.y * texture->height * t.q0;
+    setup->vq1 = t.uv1.y * texture->height * t.q1;
+    setup->vq2 = t.uv2.y * texture->height * t.q2;
+    /* Steps of the barycentric coordinates per pixel, and so of these */
+    f32 a_dx = setup->e0.step_x * setup->inv_area;
+    f32 b_dx = setup->e1.step_x * setup->inv_area;
+    f32 c_dx = setup->e2.step_x * setup->inv_area;
+    f32 a_dy = setup->e0.step_y * setup->inv_area;
+    f32 b_dy = setup->e1.step_y * setup->inv_area;
+    f32 c_dy = setup->e2.step_y * setup->inv_area;
+    setup->q_dx = a_dx * setup->q0 + b_dx * setup->q1 + c_dx * setup->q2;
+    setup->q_dy = a_dy * setup->q0 + b_dy * setup->q1 + c_dy * setup->q2;
+    setup->uq_dx = a_dx * setup->uq0 + b_dx * setup->uq1 + c_dx * setup->uq2;
+    setup->uq_dy = a_dy * setup->uq0 + b_dy * setup->uq1 + c_dy * setup->uq2;
+    setup->vq_dx = a_dx * setup->vq0 + b_dx * setup->vq1 + c_dx * setup->vq2;
+    setup->vq_dy = a_dy * setup->vq0 + b_dy * setup->vq1 + c_dy * setup->vq2;
+  }
+  return true;
+}
+/* Cull a batch of screen space triangles before setup, see raster.h */
+u32 culltris(const target_t *target, const tri_t *tris, u32 count,
+             u32 *visible, u32 *back_facing) {
+  /*
+   * First pass, without branches: snap the corners, drop the triangles
+   * facing away or of zero area and those whose box holds no pixel centre,
+   * and gather the rest with their boxes
+   */
+  const i32 half = SUBPIXEL_ONE / 2;
+  vec2_int_t corners[CULL_BATCH][3];
+  rect_t boxes[CULL_BATCH];
+  u32 front[CULL_BATCH];
+  u32 front_count = 0, back = 0;
+  for (u32 i = 0; i < count; i++) {
+    vec2_int_t v0 = snap(tris[i].v0);
+    vec2_int_t v1 = snap(tris[i].v1);
+    vec2_int_t v2 = snap(tris[i].v2);
+    /* With y pointing down, an anticlockwise triangle has a negative area */
+    i64 area = edge_function(v0, v1, v2);
+    /* Pixels whose centres it may cover, as in setuptri() */
+    i32 lo_x = MIN(MIN(v0.x, v1.x), v2.x), hi_x = MAX(MAX(v0.x, v1.x), v2.x);
+    i32 lo_y = MIN(MIN(v0.y, v1.y), v2.y), hi_y = MAX(MAX(v0.y, v1.y), v2.y);
+    rect_t box = {
+        MAX(floor_pixel(lo_x + half - 1), 0),
+        MAX(floor_pixel(lo_y + half - 1), 0),
+        MIN(floor_pixel(hi_x - half) + 1, target->width),
+        MIN(floor_pixel(hi_y - half) + 1, target->height),
+    };
+    corners[front_count][0] = v0;
+    corners[front_count][1] = v1;
+    corners[front_count][2] = v2;
+    boxes[front_count] = box;
+    front[front_count] = i;
+    back += area < 0;
+    front_count += (area > 0) & (box.min_x < box.max_x)
+                 & (box.min_y < box.max_y);
+  }
+  *back_facing += back;
+
+  /*
+   * Second pass: tiny triangles, which dominate dense meshes, often fall
+   * between pixel centres. Test the few centres in their box with the fill
+   * rule rather than pay for setting them up and binning them.
+   */
+  u32 kept = 0;
+  for (u32 i = 0; i < front_count; i++) {
+    rect_t box = boxes[i];
+    i32 width = box.max_x - box.min_x, height = box.max_y - box.min_y;
+    bool covered = width * height > CULL_SAMPLES;
+    if (!covered) {
+      vec2_int_t origin = {
+          box.min_x * SUBPIXEL_ONE + half, box.min_y * SUBPIXEL_ONE + half,
+      };
+      edge_t e0 = setup_edge(corners[i][1], corners[i][2], origin);
+      edge_t e1 = setup_edge(corners[i][2], corners[i][0], origin);
+      edge_t e2 = setup_edge(corners[i][0], corners[i][1], origin);
+      for (i32 y = 0; y < height && !covered; y++) {
+        for (i32 x = 0; x < width && !covered; x++) {
+          i64 w0 = e0.row + (i64)x * e0.step_x + (i64)y * e0.step_y;
+          i64 w1 = e1.row + (i64)x * e1.step_x + (i64)y * e1.step_y;
+          i64 w2 = e2.row + (i64)x * e2.step_x + (i64)y * e2.step_y;
+          covered = (w0 | w1 | w2) >= 0;
+        }
+      }
+    }
+    visible[kept] = front[i];
+    kept += covered;
+  }
+  return kept;
+}
+/* Smallest and largest value of an edge function over a rectangle */
+static inline void edge_range(const tri_setup_t *setup, const edge_t *edge,
+                              rect_t rect, i64 *lo, i64 *hi) {
+  i64 corner = edge->row
+      + (i64)(rect.min_x - setup->min_x) * edge->step_x
+      + (i64)(rect.min_y - setup->min_y) * edge->step_y;
+  i64 span_x = (i64)(rect.max_x - 1 - rect.min_x) * edge->step_x;
+  i64 span_y = (i64)(rect.max_y - 1 - rect.min_y) * edge->step_y;
+  *lo = corner + MIN(span_x, 0) + MIN(span_y, 0);
+  *hi = corner + MAX(span_x, 0) + MAX(span_y, 0);
+}
+/*
+ * Fill the part of a set up triangle inside a non-empty rectangle, returns
+ * true if any pixel was written
+ */
+static bool fill_rect(const target_t *target, const tri_setup_t *setup,
+                      rect_t rect, raster_stats_t *stats) {
+  tri_setup_t part = *setup;
+  part.min_x = rect.min_x;
+  part.min_y = rect.min_y;
+  part.max_x = rect.max_x;
+  part.max_y = rect.max_y;
+  /* Move the edge functions to the new top left */
+  i64 dx = part.min_x - setup->min_x;
+  i64 dy = part.min_y - setup->min_y;
+  part.e0.row += dx * part.e0.step_x + dy * part.e0.step_y;
+  part.e1.row += dx * part.e1.step_x + dy * part.e1.step_y;
+  part.e2.row += dx * part.e2.step_x + dy * part.e2.step_y;
+  /* The variant for the target's and the triangle's state */
+  shade_mode_t shade = target->ids ? SHADE_IDS
+                     : setup->texture ? SHADE_TEXTURED : SHADE_COLOR;
+  kernel_fn_t kernel = kernels[current_kernel][target->mode][shade];
+  /* Only hand the SIMD kernels edge functions that fit their lanes */
+  const edge_t *edges[3] = {&part.e0, &part.e1, &part.e2};
+  for (u32 i = 0; i < 3; i++) {
+    i64 lo, hi;
+    edge_range(&part, edges[i], rect, &lo, &hi);
+    if (lo < -EDGE_LIMIT || hi > EDGE_LIMIT)
+      kernel = kernels[RASTER_SCALAR][target->mode][shade];
+  }
+  u64 passed = stats->passed;
+  kernel(target, &part, stats);
+  return stats->passed != passed;
+}
+/*
+ * Check whether a triangle may pass the depth test somewhere in a block,
+ * from the block's coarse depth. After a depth pre-pass no block is
+ * rejected: the per-pixel equal test decides, and a bound from the
+ * triangle's vertices can't be trusted to match depths it interpolated.
+ */
+static inline bool coarse_visible(const target_t *target,
+                                  const tri_setup_t *setup, f32 coarse) {
+  if (target->mode == FILL_EQUAL)
+    return true;
+  return setup->z_min < coarse;
+}
+/* Recompute the max depth of a block from the depth buffer */
+static f32 block_max_depth(const target_t *target, rect_t block) {
+  f32 max_z = -INFINITY;
+  for (i32 y = block.min_y; y < block.max_y; y++) {
+    const f32 *depth_row = target->depth + (y * target->width);
+    for (i32 x = block.min_x; x < block.max_x; x++) {
+      max_z = MAX(max_z, depth_row[x]);
+    }
+  }
+  return max_z;
+}
+/*
+ * Fill the part of a set up triangle that lies inside a rectangle, adding
+ * the pixels tested and written to stats
+ */
+void filltri(const target_t *target, const tri_setup_t *setup, rect_t clip,
+             raster_stats_t *stats) {
+  rect_t box = {
+      MAX(setup->min_x, clip.min_x), MAX(setup->min_y, clip.min_y),
+      MIN(setup->max_x, clip.max_x), MIN(setup->max_y, clip.max_y),
+  };
+  if (box.min_x >= box.max_x || box.min_y >= box.max_y)
+    return;
+  if (!target->coarse) {
+    fill_rect(target, setup, box, stats);
+    return;
+  }
+
+  /*
+   * Walk the coarse blocks under the box. Blocks outside an edge or behind
+   * the coarse depth are skipped, runs of the rest are filled together.
+   */
+  i32 coarse_width = HIZ_SIZE(target->width);
+  i32 first_bx = box.min_x / HIZ_BLOCK, last_bx = (box.max_x - 1) / HIZ_BLOCK;
+  i32 first_by = box.min_y / HIZ_BLOCK, last_by = (box.max_y - 1) / HIZ_BLOCK;
+  for (i32 by = first_by; by <= last_by; by++) {
+    f32 *coarse_row = target->coarse + (by * coarse_width);
+    /* The block row, and the part of it inside the box */
+    i32 block_min_y = by * HIZ_BLOCK;
+    i32 block_max_y = MIN(block_min_y + HIZ_BLOCK, target->height);
+    i32 min_y = MAX(block_min_y, box.min_y);
+    i32 max_y = MIN(block_max_y, box.max_y);
+    i32 run_start = -1;
+    for (i32 bx = first_bx; bx <= last_bx + 1; bx++) {
+      bool visible = false;
+      if (bx <= last_bx && coarse_visible(target, setup, coarse_row[bx])) {
+        rect_t part = {
+            MAX(bx * HIZ_BLOCK, box.min_x), min_y,
+            MIN((bx + 1) * HIZ_BLOCK, box.max_x), max_y,
+        };
+        i64 lo, hi0, hi1, hi2;
+        edge_range(setup, &setup->e0, part, &lo, &hi0);
+        edge_range(setup, &setup->e1, part, &lo, &hi1);
+        edge_range(setup, &setup->e2, part, &lo, &hi2);
+        visible = hi0 >= 0 && hi1 >= 0 && hi2 >= 0;
+      }
+      if (visible && run_start < 0)
+        run_start = bx;
+      if (visible || run_start < 0)
+        continue;
+
+      /* Fill the run of visible blocks [run_start, bx) */
+      rect_t run = {
+          MAX(run_start * HIZ_BLOCK, box.min_x), min_y,
+          MIN(bx * HIZ_BLOCK, box.max_x), max_y,
+      };
+      bool wrote = fill_rect(target, setup, run, stats);
+      /* Update the coarse depth of the blocks in the run, if depth changed */
+      for (i32 rx = run_start; rx < bx && target->mode != FILL_EQUAL; rx++) {
+        rect_t block = {
+            rx * HIZ_BLOCK, block_min_y,
+            MIN((rx + 1) * HIZ_BLOCK, target->width), block_max_y,
+        };
+        rect_t part = {
+            MAX(block.min_x, box.min_x), min_y,
+            MIN(block.max_x, box.max_x), max_y,
+        };
+        i64 lo0, lo1, lo2, hi;
+        edge_range(setup, &setup->e0, part, &lo0, &hi);
+        edge_range(setup, &setup->e1, part, &lo1, &hi);
+        edge_range(setup, &setup->e2, part, &lo2, &hi);
+        bool covered = lo0 >= 0 && lo1 >= 0 && lo2 >= 0
+            && part.min_x == block.min_x && part.max_x == block.max_x
+            && part.min_y == block.min_y && part.max_y == block.max_y;
+        if (covered) {
+          /* Every pixel is now at most the triangle's max depth */
+          coarse_row[rx] = MIN(coarse_row[rx], setup->z_max);
+        } else if (wrote) {
+          coarse_row[rx] = block_max_depth(target, block);
+        }
+      }
+      run_start = -1;
+    }
+  }
+}
+/* Check whether an edge function stays within EDGE_LIMIT along a run */
+static inline bool span_fits(i64 w, i32 step, i32 count) {
+  i64 last = w + (i64)(count - 1) * step;
+  return MIN(w, last) >= -EDGE_LIMIT && MAX(w, last) <= EDGE_LIMIT;
+}
+/* Shade the pixels of a rectangle from its visibility buffer */
+void resolverect(const target_t *target, rect_t rect,
+                 const tri_setup_t *tris, raster_stats_t *stats) {
+  u64 shaded = 0;
+  for (i32 y = rect.min_y; y < rect.max_y; y++) {
+    u32 *ids_row = target->ids + (y * target->width);
+    u32 *color_row = target->color + (y * target->width);
+    i32 x = rect.min_x;
+    while (x < rect.max_x) {
+      u32 id = ids_row[x];
+      if (id == VIS_NONE) {
+        x++;
+        continue;
+      }
+      /* Shade the run of pixels the triangle won in one go */
+      i32 count = 1;
+      while (x + count < rect.max_x && ids_row[x + count] == id)
+        count++;
+      /*
+       * The edge functions at the run are exactly what the kernels stepped
+       * to, so it is shaded just as it would have been when filled
+       */
+      const tri_setup_t *setup = &tris[id];
+      i64 dx = x - setup->min_x, dy = y - setup->min_y;
+      i64 w0 = setup->e0.row + (dx * setup->e0.step_x)
+             + (dy * setup->e0.step_y);
+      i64 w1 = setup->e1.row + (dx * setup->e1.step_x)
+             + (dy * setup->e1.step_y);
+      i64 w2 = setup->e2.row + (dx * setup->e2.step_x)
+             + (dy * setup->e2.step_y);
+      bool textured = setup->texture != NULL;
+      span_fn_t span = spans[current_kernel][textured];
+      if (!span_fits(w0, setup->e0.step_x, count)
+          || !span_fits(w1, setup->e1.step_x, count)
+          || !span_fits(w2, setup->e2.step_x, count))
+        span = spans[RASTER_SCALAR][textured];
+      span(setup, w0, w1, w2, count, color_row + x);
+      /* Leave the buffer empty again for the next frame */
+      memset(ids_row + x, 0xff, sizeof(u32) * count);
+      shaded += count;
+      x += count;
+    }
+  }
+  stats->shaded += shaded;
+}
+/* Write a screen space triangle to a render target */
+void puttri(const target_t *target, tri_t tri, tri_col_t cols) {
+  /* Shaded straight away, there being no list of triangles to resolve */
+  target_t direct = *target;
+  direct.ids = NULL;
+  tri_setup_t setup;
+  raster_stats_t stats = {0, 0, 0};
+  if (setuptri(&direct, tri, cols, NULL, &setup))
+    filltri(&direct, &setup, (rect_t){0, 0, direct.width, direct.height},
+            &stats);
+}
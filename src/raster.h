@@ -0,0 +1,204 @@
+/* Include guard */
+#if !defined(RASTER_H)
+#define RASTER_H
+
+/* C Stdlib headers */
+#include <stdbool.h> /* For boolean type */
+
+/* Project headers */
+#include "math3d.h"  /* Vector types */
+#include "texture.h" /* Mipmapped textures */
+
+/* Pack a colour into an RGBA8888 pixel */
+#define PACK_COL(c) \
+  (((u32)(c).r << 24) | ((u32)(c).g << 16) | ((u32)(c).b << 8) | (u32)(c).a)
+
+/* Consts */
+#define HIZ_BLOCK 8 /* Width and height of a coarse depth block in pixels */
+#define TARGET_ALIGN 64 /* Alignment of a render target's buffers */
+/*
+ * Vertices are snapped to a fixed point grid of 1/SUBPIXEL_ONE pixels
+ * (28.4), so edge functions are exact and shared edges are rasterized the
+ * same way from both sides
+ */
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_ONE  (1 << SUBPIXEL_BITS)
+/*
+ * How far in pixels vertices may lie outside a render target. Keeps the
+ * fixed point coordinates and edge steps within 32 bits, and the edge
+ * functions small enough over targets up to about 4K for the kernels to
+ * step them as i32; geometry reaching further must be clipped first.
+ */
+#define GUARD_BAND 4096
+#define CULL_BATCH 64 /* Most triangles culltris() takes at once */
+/* Largest bounding box, in pixels, whose centres culltris() tests one by one */
+#define CULL_SAMPLES 4
+
+/* Visibility buffer id of a pixel no triangle has covered */
+#define VIS_NONE UINT32_MAX
+
+/* Size of the coarse depth buffer for a width or height in pixels */
+#define HIZ_SIZE(a) (((a) + HIZ_BLOCK - 1) / HIZ_BLOCK)
+
+/*
+ * What filling a triangle does to the pixels it covers. A depth pre-pass
+ * fills every triangle with FILL_DEPTH first, then again with FILL_EQUAL,
+ * so only the nearest triangle at each pixel is shaded. FILL_EQUAL allows
+ * for the depth being rounded a little differently the second time.
+ */
+typedef enum {
+  FILL_COLOR, /* Write depth and colour (or id) where nearer */
+  FILL_DEPTH, /* Write only depth where nearer */
+  FILL_EQUAL, /* Write only colour (or id) where at the depth left */
+  FILL_COUNT
+} fill_mode_t;
+
+/* The type of a render target: packed RGBA8888 colors plus depths */
+typedef struct {
+  u32 *color;
+  f32 *depth;
+  /*
+   * Coarse depth: a conservative max depth for each HIZ_BLOCK square block,
+   * HIZ_SIZE(width) blocks per row, or NULL to disable early rejection
+   */
+  f32 *coarse;
+  i32 width, height;
+  /*
+   * Visibility buffer, or NULL to shade as triangles are filled. When set,
+   * filling a triangle only writes depth and the triangle's id to the
+   * pixels it wins, and resolverect() shades each pixel once afterwards.
+   */
+  u32 *ids;
+  fill_mode_t mode;
+} target_t;
+
+/* The type of a screen space rectangle, max exclusive */
+typedef struct {
+  i32 min_x, min_y, max_x, max_y;
+} rect_t;
+
+/*
+ * An edge function of a triangle, set up once per triangle. Values are in
+ * 1/SUBPIXEL_ONE square pixels, sampled at pixel centres, and biased so a
+ * pixel is covered when all three are >= 0 (see setuptri()). Adding offset
+ * takes the bias back off, for interpolating.
+ */
+typedef struct {
+  i32 step_x; /* Change in value per pixel to the right */
+  i32 step_y; /* Change in value per pixel down */
+  i64 row;    /* Value at the top left of the bounding box */
+  f32 offset; /* Exact value less the biased one, the same at every pixel */
+} edge_t;
+/* Texturing of a screen space triangle */
+typedef struct {
+  const texture_t *texture;
+  vec2_t uv0, uv1, uv2; /* Corner texture coordinates, 0 to 1 across it */
+  f32 q0, q1, q2;       /* 1/w of the corners, w being view depth */
+} tri_tex_t;
+
+/* Everything the kernels need to fill one triangle */
+typedef struct {
+  i32 min_x, min_y, max_x, max_y; /* Bounding box, max exclusive */
+  edge_t e0, e1, e2;
+  f32 inv_area;
+  f32 z0, z1, z2;
+  f32 z_min, z_max; /* Conservative depth range */
+  tri_col_t cols;
+  /*
+   * Texturing, when texture isn't NULL. u/w and v/w (in texels) and 1/w
+   * are interpolated across the screen like depth, and divided per pixel
+   * for perspective correct coordinates. Their steps per pixel give the
+   * texture's rate of change, and so its mip level.
+   */
+  const texture_t *texture;
+  f32 q0, q1, q2;
+  f32 uq0, uq1, uq2;
+  f32 vq0, vq1, vq2;
+  f32 q_dx, q_dy, uq_dx, uq_dy, vq_dx, vq_dy;
+  u32 id; /* Written to the visibility buffer, see target_t */
+} tri_setup_t;
+
+/* Pixel counts gathered while filling triangles */
+typedef struct {
+  u64 tested; /* Covered pixels that were depth tested */
+  u64 passed; /* Pixels that passed the depth test and were written */
+  u64 shaded; /* Pixels whose colour was worked out */
+} raster_stats_t;
+
+/* The rasterizer kernels, slowest to fastest */
+typedef enum {
+  RASTER_SCALAR,  /* One pixel at a time */
+  RASTER_SSE2,    /* 4x1 pixel blocks */
+  RASTER_AVX2,    /* 8x1 pixel blocks */
+  RASTER_COUNT
+} raster_kernel_t;
+
+/* Pick the fastest kernel the CPU supports */
+void raster_init(void);
+/* Use a specific kernel, returns false if the CPU doesn't support it */
+bool raster_set_kernel(raster_kernel_t kernel);
+/* Get the kernel in use */
+raster_kernel_t raster_get_kernel(void);
+/* Get the name of a kernel */
+const char *raster_kernel_name(raster_kernel_t kernel);
+
+/*
+ * Allocate the buffers of a render target for up to pixels pixels and
+ * blocks coarse depth blocks, in one block of memory with each buffer
+ * aligned to TARGET_ALIGN. Sets the target's buffers, not its size, and
+ * returns the memory to free(), or NULL if out of memory.
+ */
+void *alloctarget(target_t *target, u64 pixels, u64 blocks);
+/* Clear the color buffer of a render target */
+void clearscreen(const target_t *target, col_t col);
+/*
+ * Clear a render target's color, depth and coarse depth, with streaming
+ * stores. See tiles_clear() for a cheaper way during a frame.
+ */
+void cleartarget(const target_t *target, col_t col);
+/*
+ * Clear the color, depth and coarse depth of a rectangle. The coarse depth
+ * blocks it overlaps are reset, so its edges should lie on HIZ_BLOCK
+ * boundaries or the edges of the target.
+ */
+void clearrect(const target_t *target, rect_t rect, col_t col,
+               bool streaming);
+/* Write one pixel to a render target */
+void putpixel(const target_t *target, u32 x, u32 y, col_t col);
+/* Write a line to a render target */
+void putline(const target_t *target, i32 x0, i32 y0, i32 x1, i32 y1,
+             col_t col);
+/*
+ * Set up a screen space triangle, textured if tex isn't NULL. Returns false
+ * if it covers no pixels.
+ */
+bool setuptri(const target_t *target, tri_t tri, tri_col_t cols,
+              const tri_tex_t *tex, tri_setup_t *setup);
+/*
+ * Cull a batch of up to CULL_BATCH screen space triangles before setup, by
+ * the signed area of their corners snapped as setuptri() snaps them: back
+ * facing ones (wound anticlockwise on screen), ones of zero area and ones
+ * that cover no pixel centre inside the target. Writes the indices of the
+ * rest, in order, to visible and returns how many there are. The number
+ * dropped for facing away is added to back_facing.
+ */
+u32 culltris(const target_t *target, const tri_t *tris, u32 count,
+             u32 *visible, u32 *back_facing);
+/*
+ * Fill the part of a set up triangle that lies inside a rectangle, adding
+ * the pixels tested and written to stats
+ */
+void filltri(const target_t *target, const tri_setup_t *setup, rect_t clip,
+             raster_stats_t *stats);
+/*
+ * Shade the pixels of a rectangle from its visibility buffer, each by the
+ * triangle tris[id] that won its depth test, and reset their ids to
+ * VIS_NONE. Pixels no triangle covered keep their colour. Adds the pixels
+ * shaded to stats.
+ */
+void resolverect(const target_t *target, rect_t rect,
+                 const tri_setup_t *tris, raster_stats_t *stats);
+/* Write a screen space triangle to a render target */
+void puttri(const target_t *target, tri_t tri, tri_col_t cols);
+
+#endif /* RASTER_H */
@@ -0,0 +1,358 @@
+/* Implements scene.h */
+#include "scene.h"
+
+/* C Stdlib headers */
+#include <math.h>   /* sqrtf(), fabsf() */
+#include <stdlib.h> /* realloc(), free(), qsort() */
+
+/* Project headers */
+#include "profiler.h" /* Stage timers and counters */
+#include "sort.h"     /* Radix sort on depth */
+
+/* Consts */
+#define BVH_MAX_DEPTH 48 /* Deeper nodes become leaves, bounds the walk */
+#define FRUSTUM_PLANES 6
+
+/* Set the world space bounds of an object from its mesh and instance */
+static void place_object(scene_object_t *object) {
+  const bounds_t *local = &object->mesh->bounds;
+  const f32 *m = object->instance->model.vals;
+  vec4_t centre = mulm4v4(object->instance->model,
+                          (vec4_t){local->center.x, local->center.y,
+                                   local->center.z, 1.0f});
+  /* The box's half extent along each world axis */
+  vec3_t half = {
+      0.5f * (local->max.x - local->min.x),
+      0.5f * (local->max.y - local->min.y),
+      0.5f * (local->max.z - local->min.z),
+  };
+  vec3_t extent = {
+      fabsf(m[0]) * half.x + fabsf(m[1]) * half.y + fabsf(m[2]) * half.z,
+      fabsf(m[4]) * half.x + fabsf(m[5]) * half.y + fabsf(m[6]) * half.z,
+      fabsf(m[8]) * half.x + fabsf(m[9]) * half.y + fabsf(m[10]) * half.z,
+  };
+  /* The sphere grows by the largest scale of the axes */
+  f32 scale2 = 0.0f;
+  for (u32 i = 0; i < 3; i++) {
+    f32 len2 = m[i] * m[i] + m[4 + i] * m[4 + i] + m[8 + i] * m[8 + i];
+    scale2 = MAX(scale2, len2);
+  }
+  bounds_t *bounds = &object->bounds;
+  bounds->center = VTOVEC3(centre);
+  bounds->min = add_v3(bounds->center, negate_v3(extent));
+  bounds->max = add_v3(bounds->center, extent);
+  bounds->radius = local->radius * sqrtf(scale2);
+}
+/* Grow a box to take in another */
+static void grow_box(vec3_t *min, vec3_t *max, vec3_t add_min,
+                     vec3_t add_max) {
+  *min = (vec3_t){
+      MIN(min->x, add_min.x), MIN(min->y, add_min.y), MIN(min->z, add_min.z),
+  };
+  *max = (vec3_t){
+      MAX(max->x, add_max.x), MAX(max->y, add_max.y), MAX(max->z, add_max.z),
+  };
+}
+/* Get a component of a vector by axis (0 = x, 1 = y, 2 = z) */
+static f32 axis_of(vec3_t v, u32 axis) {
+  return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+/* Set the box of a leaf from its objects */
+static void fit_leaf(const scene_t *scene, bvh_node_t *node) {
+  const bounds_t *first = &scene->objects[scene->order[node->first]].bounds;
+  node->min = first->min;
+  node->max = first->max;
+  for (u32 i = 1; i < node->count; i++) {
+    const bounds_t *bounds =
+        &scene->objects[scene->order[node->first + i]].bounds;
+    grow_box(&node->min, &node->max, bounds->min, bounds->max);
+  }
+}
+/*
+ * Build the subtree of a node over a range of order. Ranges are split at
+ * the middle of their centres along the longest axis.
+ */
+static void build_node(scene_t *scene, u32 index, u32 first, u32 count,
+                       u32 depth) {
+  bvh_node_t *node = &scene->nodes[index];
+  node->first = first;
+  node->count = count;
+  fit_leaf(scene, node);
+  if (count <= SCENE_LEAF_SIZE || depth + 1 >= BVH_MAX_DEPTH)
+    return;
+
+  /* Find the longest axis of the centres */
+  vec3_t lo = {INFINITY, INFINITY, INFINITY};
+  vec3_t hi = {-INFINITY, -INFINITY, -INFINITY};
+  for (u32 i = first; i < first + count; i++) {
+    vec3_t centre = scene->objects[scene->order[i]].bounds.center;
+    grow_box(&lo, &hi, centre, centre);
+  }
+  vec3_t extent = {hi.x - lo.x, hi.y - lo.y, hi.z - lo.z};
+  u32 axis = extent.x >= extent.y && extent.x >= extent.z ? 0
+      : extent.y >= extent.z ? 1 : 2;
+  f32 split = 0.5f * (axis_of(lo, axis) + axis_of(hi, axis));
+
+  /* Partition the range around the split */
+  u32 left = first, right = first + count;
+  while (left < right) {
+    vec3_t centre = scene->objects[scene->order[left]].bounds.center;
+    if (axis_of(centre, axis) < split) {
+      left++;
+    } else {
+      right--;
+      SWAP(scene->order[left], scene->order[right]);
+    }
+  }
+  u32 left_count = left - first;
+  /* All centres on one side (or equal), split the range in half instead */
+  if (left_count == 0 || left_count == count)
+    left_count = count / 2;
+
+  u32 child = scene->node_count;
+  scene->node_count += 2;
+  node->first = child;
+  node->count = 0;
+  build_node(scene, child, first, left_count, depth + 1);
+  build_node(scene, child + 1, first + left_count, count - left_count,
+             depth + 1);
+}
+/*
+ * Test a box against the frustum planes set in a mask. Returns false if it
+ * is outside one of them, and clears the planes it is entirely inside of.
+ */
+static bool box_visible(const vec4_t *planes, vec3_t min, vec3_t max,
+                        u8 *mask) {
+  for (u32 i = 0; i < FRUSTUM_PLANES; i++) {
+    if (!(*mask & (1 << i)))
+      continue;
+    vec4_t p = planes[i];
+    /* The corners farthest along and against the plane's normal */
+    f32 far = p.x * (p.x > 0 ? max.x : min.x) + p.y * (p.y > 0 ? max.y : min.y)
+        + p.z * (p.z > 0 ? max.z : min.z) + p.w;
+    if (far < 0)
+      return false;
+    f32 near = p.x * (p.x > 0 ? min.x : max.x)
+        + p.y * (p.y > 0 ? min.y : max.y) + p.z * (p.z > 0 ? min.z : max.z)
+        + p.w;
+    if (near >= 0)
+      *mask &= ~(1 << i);
+  }
+  return true;
+}
+/* Test an object's bounding sphere against the frustum planes in a mask */
+static bool sphere_visible(const vec4_t *planes, const bounds_t *bounds,
+                           u8 mask) {
+  vec3_t centre = bounds->center;
+  for (u32 i = 0; i < FRUSTUM_PLANES; i++) {
+    vec4_t p = planes[i];
+    if ((mask & (1 << i))
+        && p.x * centre.x + p.y * centre.y + p.z * centre.z + p.w
+               < -bounds->radius)
+      return false;
+  }
+  return true;
+}
+/* Compare two u32s, for qsort() */
+static int compare_u32(const void *a, const void *b) {
+  u32 x = *(const u32 *)a, y = *(const u32 *)b;
+  return (x > y) - (x < y);
+}
+
+/* Free a scene's objects and hierarchy (not the meshes or instances) */
+void scene_free(scene_t *scene) {
+  free(scene->objects);
+  free(scene->nodes);
+  free(scene->order);
+  *scene = (scene_t){0};
+}
+/* Add count instances of a mesh to a scene, returns false if out of memory */
+bool scene_add(scene_t *scene, const mesh_t *mesh,
+               const instance_t *instances, u32 count) {
+  if (scene->object_count + count > scene->object_capacity) {
+    u32 capacity = MAX(scene->object_capacity * 2, scene->object_count + count);
+    scene_object_t *objects =
+        realloc(scene->objects, sizeof(scene_object_t) * capacity);
+    if (!objects)
+      return false;
+    scene->objects = objects;
+    scene->object_capacity = capacity;
+  }
+  for (u32 i = 0; i < count; i++) {
+    scene->objects[scene->object_count++] = (scene_object_t){
+        .mesh = mesh,
+        .instance = &instances[i],
+    };
+  }
+  scene->built = false;
+  return true;
+}
+/* Rebuild the hierarchy, after objects are added */
+bool scene_build(scene_t *scene) {
+  u32 count = scene->object_count;
+  /* Keep the old arrays on failure, so they are still freed */
+  bvh_node_t *nodes =
+      realloc(scene->nodes, sizeof(bvh_node_t) * 2 * MAX(count, 1));
+  if (nodes)
+    scene->nodes = nodes;
+  u32 *order = realloc(scene->order, sizeof(u32) * MAX(count, 1));
+  if (order)
+    scene->order = order;
+  if (!nodes || !order) {
+    scene->node_count = 0;
+    scene->built = false;
+    return false;
+  }
+  for (u32 i = 0; i < count; i++) {
+    place_object(&scene->objects[i]);
+    scene->order[i] = i;
+  }
+  scene->node_count = 0;
+  if (count > 0) {
+    scene->node_count = 1;
+    build_node(scene, 0, 0, count, 0);
+  }
+  scene->built = true;
+  return true;
+}
+/* Update the boxes of the hierarchy after objects move, keeping its shape */
+void scene_refit(scene_t *scene) {
+  if (!scene->built) {
+    scene_build(scene);
+    return;
+  }
+  for (u32 i = 0; i < scene->object_count; i++) {
+    place_object(&scene->objects[i]);
+  }
+  /* Children always come after their parent */
+  for (u32 i = scene->node_count; i-- > 0;) {
+    bvh_node_t *node = &scene->nodes[i];
+    if (node->count > 0) {
+      fit_leaf(scene, node);
+    } else {
+      const bvh_node_t *left = &scene->nodes[node->first];
+      const bvh_node_t *right = &scene->nodes[node->first + 1];
+      node->min = left->min;
+      node->max = left->max;
+      grow_box(&node->min, &node->max, right->min, right->max);
+    }
+  }
+}
+/* Draw every object that may be in view through the pipeline */
+void scene_draw(scene_t *scene, mat4_t view_proj) {
+  if (!scene->built && !scene_build(scene))
+    return;
+  if (scene->node_count == 0)
+    return;
+  prof_stage_t prev_stage = profiler_push(PROF_CLIP);
+
+  /* Frustum planes in world space, from the rows of the matrix */
+  const f32 *m = view_proj.vals;
+  vec4_t rows[4] = {
+      {m[0], m[1], m[2], m[3]},
+      {m[4], m[5], m[6], m[7]},
+      {m[8], m[9], m[10], m[11]},
+      {m[12], m[13], m[14], m[15]},
+  };
+  vec4_t planes[FRUSTUM_PLANES] = {
+      {rows[3].x + rows[0].x, rows[3].y + rows[0].y,
+       rows[3].z + rows[0].z, rows[3].w + rows[0].w}, /* Left */
+      {rows[3].x - rows[0].x, rows[3].y - rows[0].y,
+       rows[3].z - rows[0].z, rows[3].w - rows[0].w}, /* Right */
+      {rows[3].x + rows[1].x, rows[3].y + rows[1].y,
+       rows[3].z + rows[1].z, rows[3].w + rows[1].w}, /* Bottom */
+      {rows[3].x - rows[1].x, rows[3].y - rows[1].y,
+       rows[3].z - rows[1].z, rows[3].w - rows[1].w}, /* Top */
+      rows[2],                                        /* Near */
+      {rows[3].x - rows[2].x, rows[3].y - rows[2].y,
+       rows[3].z - rows[2].z, rows[3].w - rows[2].w}, /* Far */
+  };
+  /* Normalize, so plane distances can be compared with radii */
+  for (u32 i = 0; i < FRUSTUM_PLANES; i++) {
+    vec4_t *p = &planes[i];
+    f32 len = sqrtf(p->x * p->x + p->y * p->y + p->z * p->z);
+    if (len > 0) {
+      p->x /= len;
+      p->y /= len;
+      p->z /= len;
+      p->w /= len;
+    }
+  }
+
+  /* Walk the hierarchy, carrying the planes still worth testing */
+  arena_t *arena = pipeline_arena();
+  u32 *visible_objects = arena_alloc(arena, sizeof(u32) * scene->object_count);
+  if (!visible_objects) {
+    /* Out of memory, draw nothing */
+    profiler_pop(prev_stage);
+    return;
+  }
+  struct {
+    u32 node;
+    u8 mask;
+  } stack[BVH_MAX_DEPTH + 1];
+  u32 depth = 0;
+  u32 visible = 0;
+  stack[depth].node = 0;
+  stack[depth++].mask = (1 << FRUSTUM_PLANES) - 1;
+  while (depth > 0) {
+    depth--;
+    const bvh_node_t *node = &scene->nodes[stack[depth].node];
+    u8 mask = stack[depth].mask;
+    if (mask && !box_visible(planes, node->min, node->max, &mask))
+      continue;
+    if (node->count == 0) {
+      stack[depth].node = node->first + 1;
+      stack[depth++].mask = mask;
+      stack[depth].node = node->first;
+      stack[depth++].mask = mask;
+      continue;
+    }
+    for (u32 i = node->first; i < node->first + node->count; i++) {
+      u32 object = scene->order[i];
+      if (sphere_visible(planes, &scene->objects[object].bounds, mask))
+        visible_objects[visible++] = object;
+    }
+  }
+  profiler_count(PROF_INSTANCES_DRAWN, visible);
+  profiler_count(PROF_INSTANCES_CULLED, scene->object_count - visible);
+
+  u16 *keys = NULL, *key_scratch = NULL;
+  u32 *scratch = NULL;
+  if (scene->front_to_back) {
+    keys = arena_alloc(arena, sizeof(u16) * visible);
+    key_scratch = arena_alloc(arena, sizeof(u16) * visible);
+    scratch = arena_alloc(arena, sizeof(u32) * visible);
+  }
+  if (keys && key_scratch && scratch) {
+    /* Sort by the depth of their centres, coarsely, near to far */
+    for (u32 i = 0; i < visible; i++) {
+      vec3_t c = scene->objects[visible_objects[i]].bounds.center;
+      f32 z = rows[2].x * c.x + rows[2].y * c.y + rows[2].z * c.z + rows[2].w;
+      f32 w = rows[3].x * c.x + rows[3].y * c.y + rows[3].z * c.z + rows[3].w;
+      keys[i] = sort_depth_key(w > 0.0f ? z / w : 0.0f);
+    }
+    sort_radix16(keys, visible_objects, visible, key_scratch, scratch);
+  } else {
+    /*
+     * Objects are stored in the order they were added, so sorting the
+     * visible ones brings the instances of each mesh together. Out of
+     * memory to sort them front to back, they are drawn this way too.
+     */
+    qsort(visible_objects, visible, sizeof(u32), compare_u32);
+  }
+  /* Draw each run of one mesh's instances at once, none out of memory */
+  instance_t *batch = arena_alloc(arena, sizeof(instance_t) * visible);
+  for (u32 start = 0; batch && start < visible;) {
+    const mesh_t *mesh = scene->objects[visible_objects[start]].mesh;
+    u32 count = 0;
+    while (start + count < visible
+           && scene->objects[visible_objects[start + count]].mesh == mesh) {
+      batch[count] = *scene->objects[visible_objects[start + count]].instance;
+      count++;
+    }
+    pipeline_draw_instances(mesh, batch, count);
+    start += count;
+  }
+  profiler_pop(prev_stage);
+}
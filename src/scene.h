@@ -0,0 +1,77 @@
+/* Include guard */
+#if !defined(SCENE_H)
+#define SCENE_H
+
+/* Project headers */
+#include "math3d.h"   /* Vector and matrix math */
+#include "mesh.h"     /* Indexed meshes and their bounds */
+#include "pipeline.h" /* Mesh instances */
+
+/* Consts */
+#define SCENE_LEAF_SIZE 4 /* Most objects in a leaf of the hierarchy */
+
+/*
+ * A scene: a set of objects, each an instance of a mesh, with a bounding
+ * volume hierarchy (BVH) over their world space boxes. Drawing walks the
+ * hierarchy against the view frustum, so whole subtrees outside the view
+ * are skipped before any of their vertices are transformed, and subtrees
+ * entirely inside it are not tested any further. The objects left are
+ * drawn with one pipeline_draw_instances() call per mesh, or, sorting
+ * front to back, nearest first so they hide what is drawn after them, with
+ * one call per run of the same mesh.
+ */
+
+/* An object of a scene */
+typedef struct {
+  const mesh_t *mesh;         /* Not owned by the scene */
+  const instance_t *instance; /* Not owned, read again on scene_refit() */
+  bounds_t bounds;            /* World space bounds */
+} scene_object_t;
+
+/* A node of the hierarchy */
+typedef struct {
+  vec3_t min, max; /* World space box around everything below */
+  u32 first;       /* Leaf: first entry of order, inner: left child */
+  u32 count;       /* Leaf: number of objects, inner: 0 */
+} bvh_node_t;
+
+/* The type of a scene */
+typedef struct {
+  scene_object_t *objects;
+  u32 object_count, object_capacity;
+  /* Hierarchy, leaves refer to objects through order */
+  bvh_node_t *nodes;
+  u32 node_count;
+  u32 *order;
+  bool built;
+  bool front_to_back; /* Draw visible objects nearest first */
+} scene_t;
+
+/* Free a scene's objects and hierarchy (not the meshes or instances) */
+void scene_free(scene_t *scene);
+/*
+ * Add count instances of a mesh to a scene. Both must outlive the scene,
+ * and instances may be changed between frames followed by scene_refit().
+ * Returns false, adding none, if out of memory.
+ */
+bool scene_add(scene_t *scene, const mesh_t *mesh,
+               const instance_t *instances, u32 count);
+/*
+ * Rebuild the hierarchy, after objects are added. Returns false if out of
+ * memory, leaving the scene unbuilt, and drawing it draws nothing.
+ */
+bool scene_build(scene_t *scene);
+/*
+ * Update the boxes of the hierarchy after instances move or mesh bounds
+ * change, keeping its shape. Cheaper than scene_build(), but the hierarchy
+ * gets looser the further objects travel.
+ */
+void scene_refit(scene_t *scene);
+/*
+ * Draw every object that may be in view through the pipeline, between
+ * pipeline_begin() and pipeline_end(). Scratch space comes from
+ * pipeline_arena().
+ */
+void scene_draw(scene_t *scene, mat4_t view_proj);
+
+#endif /* SCENE_H */
@@ -0,0 +1,52 @@
+/* Implements sort.h */
+#include "sort.h"
+
+/* C Stdlib headers */
+#include <string.h> /* memcpy() */
+
+/* Sort count values by their keys, both arrays being reordered */
+void sort_radix16(u16 *keys, u32 *values, u32 count, u16 *key_scratch,
+                  u32 *value_scratch) {
+  /* Count both bytes of every key in one go */
+  u32 counts[2][256] = {{0}};
+  for (u32 i = 0; i < count; i++) {
+    counts[0][keys[i] & 0xff]++;
+    counts[1][keys[i] >> 8]++;
+  }
+  u16 *src_keys = keys, *dst_keys = key_scratch;
+  u32 *src_values = values, *dst_values = value_scratch;
+  for (u32 pass = 0; pass < 2; pass++) {
+    u32 shift = 8 * pass;
+    /* A byte every key shares doesn't change the order */
+    if (count == 0 || counts[pass][(src_keys[0] >> shift) & 0xff] == count)
+      continue;
+    /* Turn the counts into where each byte's run starts */
+    u32 offsets[256];
+    u32 total = 0;
+    for (u32 i = 0; i < 256; i++) {
+      offsets[i] = total;
+      total += counts[pass][i];
+    }
+    for (u32 i = 0; i < count; i++) {
+      u32 slot = offsets[(src_keys[i] >> shift) & 0xff]++;
+      dst_keys[slot] = src_keys[i];
+      dst_values[slot] = src_values[i];
+    }
+    u16 *keys_swap = src_keys;
+    src_keys = dst_keys;
+    dst_keys = keys_swap;
+    u32 *values_swap = src_values;
+    src_values = dst_values;
+    dst_values = values_swap;
+  }
+  /* After an odd number of passes the sorted arrays are the scratch ones */
+  if (src_keys != keys) {
+    memcpy(keys, src_keys, sizeof(u16) * count);
+    memcpy(values, src_values, sizeof(u32) * count);
+  }
+}
+/* Quantize a depth from 0 (near) to 1 (far) to a key */
+u16 sort_depth_key(f32 depth) {
+  depth = MIN(MAX(depth, 0.0f), 1.0f);
+  return (u16)(depth * 65535.0f);
+}
@@ -0,0 +1,24 @@
+/* Include guard */
+#if !defined(SORT_H)
+#define SORT_H
+
+/* Project headers */
+#include "math3d.h" /* Integer types */
+
+/*
+ * Radix sort on 16-bit keys, for putting what gets drawn in depth order.
+ * Keys are quantized depths, so two passes over their bytes sort them in
+ * time linear in the count rather than the n log n of a comparison sort.
+ * It is stable: values with equal keys keep the order they were in.
+ */
+
+/*
+ * Sort count values by their keys, both arrays being reordered. The
+ * scratch arrays must hold count entries each.
+ */
+void sort_radix16(u16 *keys, u32 *values, u32 count, u16 *key_scratch,
+                  u32 *value_scratch);
+/* Quantize a depth from 0 (near) to 1 (far) to a key, clamping */
+u16 sort_depth_key(f32 depth);
+
+#endif /* SORT_H */
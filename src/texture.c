@@ -0,0 +1,206 @@
+/* Implements texture.h */
+#include "texture.h"
+
+/* C Stdlib headers */
+#include <stdio.h>  /* File I/O */
+#include <stdlib.h> /* malloc(), free() */
+#include <string.h> /* memset() */
+
+/* Round up to a power of two */
+static i32 next_pow2(i32 a) {
+  i32 res = 1;
+  while (res < a)
+    res *= 2;
+  return res;
+}
+/* Base two log of a power of two */
+static u32 log2_pow2(u32 a) {
+  u32 res = 0;
+  while (a >> (res + 1))
+    res++;
+  return res;
+}
+/* Spread the low 16 bits of a out to the even bits */
+static u32 spread_bits(u32 a) {
+  a &= 0xffff;
+  a = (a | (a << 8)) & 0x00ff00ff;
+  a = (a | (a << 4)) & 0x0f0f0f0f;
+  a = (a | (a << 2)) & 0x33333333;
+  a = (a | (a << 1)) & 0x55555555;
+  return a;
+}
+/*
+ * Part of a texel's index due to its x, in a level of width x height
+ * texels, square_bits being the log2 of the smaller side: its bits of the
+ * Morton index within its square, plus the squares before it. Only one of
+ * x and y can be past the first square, so the parts for x and y
+ * (texel_index_y()) add up to the index.
+ */
+static u32 texel_index_x(u32 x, u32 square_bits) {
+  u32 mask = (1u << square_bits) - 1;
+  return spread_bits(x & mask) + ((x >> square_bits) << (2 * square_bits));
+}
+/* Part of a texel's index due to its y, see texel_index_x() */
+static u32 texel_index_y(u32 y, u32 square_bits) {
+  u32 mask = (1u << square_bits) - 1;
+  return (spread_bits(y & mask) << 1)
+       + ((y >> square_bits) << (2 * square_bits));
+}
+/* Index of a texel in a level, see texel_index_x() */
+static u32 texel_index(u32 x, u32 y, u32 square_bits) {
+  return texel_index_x(x, square_bits) + texel_index_y(y, square_bits);
+}
+/* Average four RGBA8888 texels, per channel */
+static u32 average4(u32 a, u32 b, u32 c, u32 d) {
+  u32 res = 0;
+  for (u32 shift = 0; shift < 32; shift += 8) {
+    u32 sum = ((a >> shift) & 0xff) + ((b >> shift) & 0xff)
+            + ((c >> shift) & 0xff) + ((d >> shift) & 0xff);
+    res |= ((sum + 2) / 4) << shift;
+  }
+  return res;
+}
+/* Blend two packed pairs of 8-bit channels, weight out of 256 */
+static u32 lerp_pairs(u32 a, u32 b, u32 weight) {
+  return (((a * (256 - weight)) + (b * weight)) >> 8) & 0x00ff00ff;
+}
+
+/* Create a texture from row major RGBA8888 pixels */
+bool texture_create(texture_t *texture, const u32 *pixels, i32 width,
+                    i32 height) {
+  memset(texture, 0, sizeof(*texture));
+  i32 w = next_pow2(width), h = next_pow2(height);
+  /* Lay out the mip chain */
+  u64 total = 0;
+  u32 levels = 0;
+  for (i32 lw = w, lh = h; levels < TEXTURE_MAX_LEVELS; levels++) {
+    texture->offsets[levels] = total;
+    total += (u64)lw * lh;
+    if (lw == 1 && lh == 1) {
+      levels++;
+      break;
+    }
+    lw = MAX(lw / 2, 1);
+    lh = MAX(lh / 2, 1);
+  }
+  texture->texels = malloc(sizeof(u32) * total);
+  if (!texture->texels)
+    return false;
+  texture->width = w;
+  texture->height = h;
+  texture->level_count = levels;
+
+  /* Level 0, resampled to the nearest pixel if it had to grow */
+  u32 square_bits = log2_pow2(MIN(w, h));
+  for (i32 y = 0; y < h; y++) {
+    const u32 *row = pixels + ((u64)(y * height / h) * width);
+    for (i32 x = 0; x < w; x++) {
+      texture->texels[texel_index(x, y, square_bits)] = row[x * width / w];
+    }
+  }
+  /* Each level after it is a 2x2 box filter of the one before */
+  for (u32 level = 1; level < levels; level++) {
+    i32 pw = MAX(w >> (level - 1), 1), ph = MAX(h >> (level - 1), 1);
+    i32 lw = MAX(w >> level, 1), lh = MAX(h >> level, 1);
+    u32 prev_bits = log2_pow2(MIN(pw, ph));
+    u32 bits = log2_pow2(MIN(lw, lh));
+    const u32 *prev = texture->texels + texture->offsets[level - 1];
+    u32 *dst = texture->texels + texture->offsets[level];
+    for (i32 y = 0; y < lh; y++) {
+      for (i32 x = 0; x < lw; x++) {
+        /* A side already down to one texel is not halved */
+        u32 x0 = (2 * x) % pw, x1 = (2 * x + 1) % pw;
+        u32 y0 = (2 * y) % ph, y1 = (2 * y + 1) % ph;
+        dst[texel_index(x, y, bits)] = average4(
+            prev[texel_index(x0, y0, prev_bits)],
+            prev[texel_index(x1, y0, prev_bits)],
+            prev[texel_index(x0, y1, prev_bits)],
+            prev[texel_index(x1, y1, prev_bits)]
+        );
+      }
+    }
+  }
+  return true;
+}
+/* Load a texture from a binary (P6) PPM file */
+bool texture_load(const char *path, texture_t *texture) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return false;
+  i32 width = 0, height = 0, max_val = 0;
+  bool ok = fscanf(file, "P6 %d %d %d", &width, &height, &max_val) == 3
+      && width > 0 && height > 0 && max_val == 255 && fgetc(file) != EOF;
+  u8 *rgb = ok ? malloc(3 * (u64)width * height) : NULL;
+  u32 *pixels = ok ? malloc(sizeof(u32) * width * height) : NULL;
+  ok = rgb && pixels
+      && fread(rgb, 3, (u64)width * height, file) == (u64)width * height;
+  fclose(file);
+  if (ok) {
+    for (u64 i = 0; i < (u64)width * height; i++) {
+      pixels[i] = ((u32)rgb[3 * i] << 24) | ((u32)rgb[3 * i + 1] << 16)
+                | ((u32)rgb[3 * i + 2] << 8) | 0xff;
+    }
+    ok = texture_create(texture, pixels, width, height);
+  }
+  free(rgb);
+  free(pixels);
+  return ok;
+}
+/* Create a checkerboard texture of cells x cells squares */
+bool texture_checker(texture_t *texture, i32 size, i32 cells, col_t a,
+                     col_t b) {
+  u32 *pixels = malloc(sizeof(u32) * size * size);
+  if (!pixels)
+    return false;
+  u32 col_a = ((u32)a.r << 24) | ((u32)a.g << 16) | ((u32)a.b << 8) | a.a;
+  u32 col_b = ((u32)b.r << 24) | ((u32)b.g << 16) | ((u32)b.b << 8) | b.a;
+  for (i32 y = 0; y < size; y++) {
+    for (i32 x = 0; x < size; x++) {
+      bool odd = ((x * cells / size) + (y * cells / size)) & 1;
+      pixels[(y * size) + x] = odd ? col_b : col_a;
+    }
+  }
+  bool ok = texture_create(texture, pixels, size, size);
+  free(pixels);
+  return ok;
+}
+/* Free a texture's texels */
+void texture_free(texture_t *texture) {
+  free(texture->texels);
+  memset(texture, 0, sizeof(*texture));
+}
+
+/* Sample a texture with bilinear filtering from the nearest mip level */
+u32 texture_sample(const texture_t *texture, f32 u, f32 v, f32 lod) {
+  i32 level = (i32)(lod + 0.5f);
+  level = MIN(MAX(level, 0), (i32)texture->level_count - 1);
+  i32 w = MAX(texture->width >> level, 1);
+  i32 h = MAX(texture->height >> level, 1);
+  u32 bits = __builtin_ctz(MIN(w, h));
+  const u32 *texels = texture->texels + texture->offsets[level];
+  /* Texel coordinates of the top left of the footprint, and the weights */
+  union {
+    u32 u;
+    f32 f;
+  } scale = {(u32)(127 - level) << 23}; /* 2^-level */
+  f32 tu = u * scale.f - 0.5f, tv = v * scale.f - 0.5f;
+  /* Round down, as truncation rounds negative coordinates up */
+  i32 iu = (i32)tu - (tu < 0.0f), iv = (i32)tv - (tv < 0.0f);
+  u32 wu = (u32)((tu - iu) * 256.0f), wv = (u32)((tv - iv) * 256.0f);
+  u32 x0 = iu & (w - 1), y0 = iv & (h - 1);
+  u32 x1 = (x0 + 1) & (w - 1), y1 = (y0 + 1) & (h - 1);
+  u32 ix0 = texel_index_x(x0, bits), ix1 = texel_index_x(x1, bits);
+  u32 iy0 = texel_index_y(y0, bits), iy1 = texel_index_y(y1, bits);
+  u32 t00 = texels[ix0 + iy0];
+  u32 t10 = texels[ix1 + iy0];
+  u32 t01 = texels[ix0 + iy1];
+  u32 t11 = texels[ix1 + iy1];
+  /* Blend two channels at a time: bytes 0 and 2, then 1 and 3 */
+  u32 lo = lerp_pairs(lerp_pairs(t00 & 0x00ff00ff, t10 & 0x00ff00ff, wu),
+                      lerp_pairs(t01 & 0x00ff00ff, t11 & 0x00ff00ff, wu), wv);
+  u32 hi = lerp_pairs(lerp_pairs((t00 >> 8) & 0x00ff00ff,
+                                 (t10 >> 8) & 0x00ff00ff, wu),
+                      lerp_pairs((t01 >> 8) & 0x00ff00ff,
+                                 (t11 >> 8) & 0x00ff00ff, wu), wv);
+  return lo | (hi << 8);
+}
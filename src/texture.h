@@ -0,0 +1,52 @@
+/* Include guard */
+#if !defined(TEXTURE_H)
+#define TEXTURE_H
+
+/* C Stdlib headers */
+#include <stdbool.h> /* For boolean type */
+
+/* Project headers */
+#include "math3d.h" /* Integer types */
+
+/* Consts */
+#define TEXTURE_MAX_LEVELS 16 /* Mip levels, enough for 32768 texels a side */
+
+/*
+ * A mipmapped texture. Every level is half the size of the one before, down
+ * to 1x1, and both sizes are powers of two so coordinates wrap with a
+ * mask. Texels are stored in Morton (Z) order rather than row by row, so
+ * texels that are close in 2D are close in memory whichever way a triangle
+ * walks across the texture: a bilinear footprint, or a span of pixels
+ * stepping down the texture, stays within a few cache lines. A level that
+ * isn't square is a row or column of Morton ordered squares.
+ */
+typedef struct {
+  i32 width, height; /* Of level 0 */
+  u32 level_count;
+  u32 *texels; /* RGBA8888, each level in turn */
+  u64 offsets[TEXTURE_MAX_LEVELS]; /* Of each level in texels */
+} texture_t;
+
+/*
+ * Create a texture from row major RGBA8888 pixels, building its mip chain.
+ * Sizes that aren't powers of two are rounded up, resampling to the
+ * nearest pixel. Returns false if out of memory.
+ */
+bool texture_create(texture_t *texture, const u32 *pixels, i32 width,
+                    i32 height);
+/* Load a texture from a binary (P6) PPM file, returns false on error */
+bool texture_load(const char *path, texture_t *texture);
+/* Create a checkerboard texture of cells x cells squares */
+bool texture_checker(texture_t *texture, i32 size, i32 cells, col_t a,
+                     col_t b);
+/* Free a texture's texels */
+void texture_free(texture_t *texture);
+
+/*
+ * Sample a texture with bilinear filtering from the mip level nearest lod
+ * (0 being full size). u and v are in texels of level 0, wrapping around
+ * at the edges, with texel centres at half integers.
+ */
+u32 texture_sample(const texture_t *texture, f32 u, f32 v, f32 lod);
+
+#endif /* TEXTURE_H */
@@ -0,0 +1,403 @@
+/* Implements tiles.h */
+#include "tiles.h"
+
+/* SDL2, for threads and atomics */
+#include <SDL2/SDL.h>
+
+/* C Stdlib headers */
+#include <stdlib.h> /* malloc(), calloc(), realloc(), free() */
+#include <string.h> /* memset() */
+
+/* Project headers */
+#include "profiler.h" /* Stage timers and counters */
+#include "sort.h"     /* Radix sort on depth */
+
+/* The list of triangles overlapping one tile */
+typedef struct {
+  u32 *tris;
+  u32 count, capacity;
+} bin_t;
+
+/* The triangles of one frame, set up and binned */
+typedef struct {
+  target_t target;
+  i32 tiles_x, tiles_y;
+  tri_setup_t *tris;
+  u32 tri_count, tri_capacity;
+  bin_t *bins;
+  raster_stats_t *stats; /* Per tile, so workers never share counters */
+  u32 bin_capacity;
+  /* Whether each tile is cleared before it is filled, see tiles_clear() */
+  bool clear;
+  col_t clear_col;
+  /*
+   * Visibility buffer when shading deferred, see tiles_set_deferred().
+   * Resolving a tile empties it again, so it is all VIS_NONE between
+   * frames and never needs clearing.
+   */
+  bool deferred;
+  u32 *ids;
+  u64 ids_capacity;
+  /* Fill order within each tile, see tiles_set_sorted() and _prepass() */
+  bool sorted;
+  bool prepass;
+} batch_t;
+
+/* One thread's room for sorting the bins it fills */
+typedef struct {
+  u16 *keys, *key_scratch;
+  u32 *scratch;
+  u32 capacity;
+} sort_space_t;
+
+/* Tiled rasterizer state */
+static struct {
+  /* Worker pool */
+  SDL_Thread **workers;
+  u32 worker_count;
+  SDL_sem *start;
+  SDL_sem *done;
+  SDL_atomic_t next_tile;
+  bool quit;
+  /*
+   * Two batches, so one can be binned while the workers fill the other:
+   * triangles are binned into the current one, and the active one is being
+   * filled when pending is set
+   */
+  batch_t batches[2];
+  batch_t *current;
+  batch_t *active;
+  bool pending;
+  /* Shade after each tile's depth is resolved, for the batches to come */
+  bool deferred;
+  /* Fill front to back, and depth first, for the batches to come */
+  bool sorted;
+  bool prepass;
+  /* Per thread, the calling thread's first and then each worker's */
+  sort_space_t *sort_spaces;
+} tiles = {.current = &tiles.batches[0]};
+
+/*
+ * Sort a bin front to back by its triangles' nearest depths. Bins are
+ * sorted as they are filled, each by the thread filling it, so the sorting
+ * is spread over the workers.
+ */
+static void sort_bin(const batch_t *batch, bin_t *bin, sort_space_t *space) {
+  if (bin->count > space->capacity) {
+    free(space->keys);
+    free(space->key_scratch);
+    free(space->scratch);
+    space->capacity = MAX(bin->count, space->capacity * 2);
+    space->keys = malloc(sizeof(u16) * space->capacity);
+    space->key_scratch = malloc(sizeof(u16) * space->capacity);
+    space->scratch = malloc(sizeof(u32) * space->capacity);
+    if (!space->keys || !space->key_scratch || !space->scratch) {
+      /* Out of memory, fill in submission order */
+      space->capacity = 0;
+      return;
+    }
+  }
+  for (u32 i = 0; i < bin->count; i++) {
+    space->keys[i] = sort_depth_key(batch->tris[bin->tris[i]].z_min);
+  }
+  sort_radix16(space->keys, bin->tris, bin->count, space->key_scratch,
+               space->scratch);
+}
+
+/*
+ * Fill one tile with every triangle in its bin, in submission order unless
+ * sorted
+ */
+static void fill_tile(const batch_t *batch, u32 index, sort_space_t *space) {
+  bin_t *bin = &batch->bins[index];
+  i32 tile_x = (index % batch->tiles_x) * TILE_SIZE;
+  i32 tile_y = (index / batch->tiles_x) * TILE_SIZE;
+  rect_t clip = {
+      tile_x, tile_y,
+      MIN(tile_x + TILE_SIZE, batch->target.width),
+      MIN(tile_y + TILE_SIZE, batch->target.height),
+  };
+  /* The first touch of a tile clears it, while it is hot in the cache */
+  if (batch->clear)
+    clearrect(&batch->target, clip, batch->clear_col, bin->count == 0);
+  if (batch->sorted && space)
+    sort_bin(batch, bin, space);
+  raster_stats_t stats = {0, 0, 0};
+  target_t target = batch->target;
+  if (batch->prepass) {
+    /*
+     * Lay down the nearest depth first, then fill again only where each
+     * triangle is at it. Only the second fill's passes are shaded.
+     */
+    target.mode = FILL_DEPTH;
+    for (u32 i = 0; i < bin->count; i++) {
+      filltri(&target, &batch->tris[bin->tris[i]], clip, &stats);
+    }
+    target.mode = FILL_EQUAL;
+  }
+  raster_stats_t shading = {0, 0, 0};
+  for (u32 i = 0; i < bin->count; i++) {
+    filltri(&target, &batch->tris[bin->tris[i]], clip, &shading);
+  }
+  /* Shade each pixel once, by the triangle left in front, while it's hot */
+  if (batch->deferred && bin->count > 0)
+    resolverect(&target, clip, batch->tris, &shading);
+  else
+    shading.shaded = shading.passed;
+  /* Depth passes are counted once, in the pre-pass if there was one */
+  stats.tested += shading.tested;
+  if (!batch->prepass)
+    stats.passed = shading.passed;
+  stats.shaded = shading.shaded;
+  batch->stats[index] = stats;
+}
+/* Take active tiles off the shared counter until there are none left */
+static void fill_tiles(sort_space_t *space) {
+  const batch_t *batch = tiles.active;
+  u32 tile_count = batch->tiles_x * batch->tiles_y;
+  while (true) {
+    u32 index = SDL_AtomicAdd(&tiles.next_tile, 1);
+    if (index >= tile_count)
+      break;
+    if (batch->clear || batch->bins[index].count > 0)
+      fill_tile(batch, index, space);
+  }
+}
+/* Hand the current batch to the workers */
+static void start_batch(void) {
+  tiles.active = tiles.current;
+  tiles.pending = true;
+  SDL_AtomicSet(&tiles.next_tile, 0);
+  for (u32 i = 0; i < tiles.worker_count; i++) {
+    SDL_SemPost(tiles.start);
+  }
+}
+/* Wait for the workers to finish the active batch and report its counts */
+static void finish_batch(void) {
+  for (u32 i = 0; i < tiles.worker_count; i++) {
+    SDL_SemWait(tiles.done);
+  }
+  tiles.pending = false;
+  if (profiler_enabled()) {
+    const batch_t *batch = tiles.active;
+    raster_stats_t total = {0, 0, 0};
+    for (i32 i = 0; i < batch->tiles_x * batch->tiles_y; i++) {
+      if (batch->bins[i].count == 0)
+        continue;
+      total.tested += batch->stats[i].tested;
+      total.passed += batch->stats[i].passed;
+      total.shaded += batch->stats[i].shaded;
+    }
+    profiler_count(PROF_PIXELS_TESTED, total.tested);
+    profiler_count(PROF_DEPTH_PASSES, total.passed);
+    profiler_count(PROF_PIXELS_SHADED, total.shaded);
+  }
+}
+/* Worker thread entry point */
+static int worker_main(void *data) {
+  sort_space_t *space = data;
+  while (true) {
+    SDL_SemWait(tiles.start);
+    if (tiles.quit)
+      break;
+    fill_tiles(space);
+    SDL_SemPost(tiles.done);
+  }
+  return 0;
+}
+
+/* Start the worker pool, threads counts the calling thread (0 = per CPU) */
+bool tiles_init(u32 threads) {
+  if (threads == 0)
+    threads = MAX(SDL_GetCPUCount(), 1);
+  tiles.start = SDL_CreateSemaphore(0);
+  tiles.done = SDL_CreateSemaphore(0);
+  if (!tiles.start || !tiles.done)
+    return false;
+  tiles.quit = false;
+  tiles.worker_count = 0;
+  tiles.workers = malloc(sizeof(SDL_Thread *) * MAX(threads - 1, 1));
+  tiles.sort_spaces = calloc(threads, sizeof(sort_space_t));
+  if (!tiles.workers || !tiles.sort_spaces)
+    return false;
+  for (u32 i = 0; i + 1 < threads; i++) {
+    SDL_Thread *worker = SDL_CreateThread(worker_main, "tile worker",
+                                          &tiles.sort_spaces[i + 1]);
+    if (!worker)
+      break;
+    tiles.workers[tiles.worker_count++] = worker;
+  }
+  return tiles.worker_count + 1 == threads;
+}
+/* Stop the worker pool and free the bins */
+void tiles_quit(void) {
+  tiles_wait();
+  tiles.quit = true;
+  for (u32 i = 0; i < tiles.worker_count; i++) {
+    SDL_SemPost(tiles.start);
+  }
+  for (u32 i = 0; i < tiles.worker_count; i++) {
+    SDL_WaitThread(tiles.workers[i], NULL);
+  }
+  for (u32 i = 0; tiles.sort_spaces && i <= tiles.worker_count; i++) {
+    free(tiles.sort_spaces[i].keys);
+    free(tiles.sort_spaces[i].key_scratch);
+    free(tiles.sort_spaces[i].scratch);
+  }
+  free(tiles.sort_spaces);
+  free(tiles.workers);
+  SDL_DestroySemaphore(tiles.start);
+  SDL_DestroySemaphore(tiles.done);
+  for (u32 b = 0; b < 2; b++) {
+    batch_t *batch = &tiles.batches[b];
+    for (u32 i = 0; i < batch->bin_capacity; i++) {
+      free(batch->bins[i].tris);
+    }
+    free(batch->bins);
+    free(batch->stats);
+    free(batch->tris);
+    free(batch->ids);
+    *batch = (batch_t){0};
+  }
+  tiles.workers = NULL;
+  tiles.sort_spaces = NULL;
+  tiles.worker_count = 0;
+}
+/* Get the number of threads that fill tiles, including the caller */
+u32 tiles_thread_count(void) {
+  return tiles.worker_count + 1;
+}
+
+/* Shade after resolving depth, or as triangles are filled */
+void tiles_set_deferred(bool enabled) {
+  tiles.deferred = enabled;
+}
+/* Fill each tile's triangles front to back, or in submission order */
+void tiles_set_sorted(bool enabled) {
+  tiles.sorted = enabled;
+}
+/* Fill each tile's depth before its colour, or both at once */
+void tiles_set_prepass(bool enabled) {
+  tiles.prepass = enabled;
+}
+/* Grow a batch's bins and their stats, returns false if out of memory */
+static bool grow_bins(batch_t *batch, u32 tile_count) {
+  /* Keep what did grow, so it is still freed */
+  bin_t *bins = realloc(batch->bins, sizeof(bin_t) * tile_count);
+  if (bins)
+    batch->bins = bins;
+  raster_stats_t *stats =
+      realloc(batch->stats, sizeof(raster_stats_t) * tile_count);
+  if (stats)
+    batch->stats = stats;
+  if (!bins || !stats)
+    return false;
+  memset(batch->bins + batch->bin_capacity, 0,
+         sizeof(bin_t) * (tile_count - batch->bin_capacity));
+  batch->bin_capacity = tile_count;
+  return true;
+}
+/* Start collecting triangles for a render target */
+void tiles_begin(const target_t *target) {
+  batch_t *batch = tiles.current;
+  batch->target = *target;
+  batch->tiles_x = (target->width + TILE_SIZE - 1) / TILE_SIZE;
+  batch->tiles_y = (target->height + TILE_SIZE - 1) / TILE_SIZE;
+  u32 tile_count = batch->tiles_x * batch->tiles_y;
+  if (tile_count > batch->bin_capacity && !grow_bins(batch, tile_count)) {
+    /* Out of memory, with no tiles nothing is binned or filled */
+    batch->tiles_x = batch->tiles_y = 0;
+    tile_count = 0;
+  }
+  for (u32 i = 0; i < tile_count; i++) {
+    batch->bins[i].count = 0;
+  }
+  batch->tri_count = 0;
+  batch->clear = false;
+  batch->sorted = tiles.sorted;
+  batch->prepass = tiles.prepass;
+  /* Grow the visibility buffer to the target if shading deferred */
+  u64 pixels = (u64)target->width * target->height;
+  batch->deferred = tiles.deferred;
+  if (batch->deferred && pixels > batch->ids_capacity) {
+    free(batch->ids);
+    batch->ids = malloc(sizeof(u32) * pixels);
+    batch->ids_capacity = batch->ids ? pixels : 0;
+    batch->deferred = batch->ids != NULL;
+    if (batch->ids)
+      memset(batch->ids, 0xff, sizeof(u32) * pixels);
+  }
+  batch->target.ids = batch->deferred ? batch->ids : NULL;
+}
+/* Clear the target lazily, as each tile is filled */
+void tiles_clear(col_t col) {
+  tiles.current->clear = true;
+  tiles.current->clear_col = col;
+}
+/* Set up a screen space triangle, textured if tex isn't NULL, and bin it */
+void tiles_submit(tri_t tri, tri_col_t cols, const tri_tex_t *tex) {
+  batch_t *batch = tiles.current;
+  if (batch->tiles_x == 0)
+    return;
+  if (batch->tri_count == batch->tri_capacity) {
+    u32 capacity = MAX(batch->tri_capacity * 2, 256);
+    tri_setup_t *tris = realloc(batch->tris, sizeof(tri_setup_t) * capacity);
+    if (!tris)
+      return; /* Out of memory, drop the triangle */
+    batch->tris = tris;
+    batch->tri_capacity = capacity;
+  }
+  prof_stage_t prev_stage = profiler_push(PROF_SETUP);
+  tri_setup_t *setup = &batch->tris[batch->tri_count];
+  if (!setuptri(&batch->target, tri, cols, tex, setup)) {
+    profiler_pop(prev_stage);
+    return;
+  }
+  u32 index = batch->tri_count++;
+  setup->id = index;
+  /* Add to the bin of every tile the bounding box overlaps */
+  i32 min_tx = setup->min_x / TILE_SIZE;
+  i32 min_ty = setup->min_y / TILE_SIZE;
+  i32 max_tx = (setup->max_x - 1) / TILE_SIZE;
+  i32 max_ty = (setup->max_y - 1) / TILE_SIZE;
+  for (i32 ty = min_ty; ty <= max_ty; ty++) {
+    for (i32 tx = min_tx; tx <= max_tx; tx++) {
+      bin_t *bin = &batch->bins[(ty * batch->tiles_x) + tx];
+      if (bin->count == bin->capacity) {
+        u32 capacity = MAX(bin->capacity * 2, 64);
+        u32 *tris = realloc(bin->tris, sizeof(u32) * capacity);
+        if (!tris)
+          continue; /* Out of memory, leave the triangle out of this tile */
+        bin->tris = tris;
+        bin->capacity = capacity;
+      }
+      bin->tris[bin->count++] = index;
+    }
+  }
+  profiler_pop(prev_stage);
+}
+/* Fill every bin in parallel and wait for all tiles to finish */
+void tiles_flush(void) {
+  tiles_wait();
+  start_batch();
+  /* The calling thread fills tiles too */
+  fill_tiles(tiles.sort_spaces);
+  finish_batch();
+}
+/* Start filling every bin on the workers and return straight away */
+void tiles_kick(void) {
+  tiles_wait();
+  if (tiles.worker_count == 0) {
+    /* Nobody else to fill them */
+    tiles_flush();
+    return;
+  }
+  start_batch();
+  tiles.current = tiles.current == &tiles.batches[0] ? &tiles.batches[1]
+                                                     : &tiles.batches[0];
+}
+/* Wait for the tiles started by tiles_kick() to finish, if any */
+void tiles_wait(void) {
+  if (tiles.pending)
+    finish_batch();
+}
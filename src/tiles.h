@@ -0,0 +1,90 @@
+/* Include guard */
+#if !defined(TILES_H)
+#define TILES_H
+
+/* C Stdlib headers */
+#include <stdbool.h> /* For boolean type */
+
+/* Project headers */
+#include "math3d.h" /* Vector types */
+#include "raster.h" /* Render targets and triangle setup */
+
+/* Consts */
+#define TILE_SIZE 64  /* Width and height of a screen tile in pixels */
+
+/*
+ * Tiled rasterizer: triangles are set up and binned into the screen tiles
+ * their bounding boxes overlap, then a pool of worker threads fills the
+ * tiles in parallel. Each tile is owned by one thread at a time, so pixel
+ * data needs no locks, and triangles are filled in submission order within
+ * a tile, so the result matches filling them serially.
+ *
+ * Binning is double buffered: after tiles_kick() the workers fill one
+ * frame's tiles on their own while the caller bins the next frame.
+ */
+
+/* Start the worker pool, threads counts the calling thread (0 = per CPU) */
+bool tiles_init(u32 threads);
+/* Stop the worker pool and free the bins */
+void tiles_quit(void);
+/* Get the number of threads that fill tiles, including the caller */
+u32 tiles_thread_count(void);
+
+/*
+ * Shade deferred, from the next tiles_begin() on (off by default). Filling
+ * a tile then only finds the triangle in front at each pixel, keeping its
+ * id in a visibility buffer, and each pixel is shaded once after the last
+ * triangle, however many were drawn over it: shading costs scale with the
+ * target's size rather than with overdraw.
+ */
+void tiles_set_deferred(bool enabled);
+/*
+ * Fill each tile's triangles front to back, from the next tiles_begin() on
+ * (off by default). Each bin is radix sorted on its triangles' nearest
+ * depths just before the tile is filled, so nearer triangles are drawn
+ * first and the depth test rejects more of what lies behind them.
+ * Triangles at the same depth keep their order, but which of two
+ * intersecting triangles wins a pixel at equal depth may change.
+ */
+void tiles_set_sorted(bool enabled);
+/*
+ * Fill each tile twice, from the next tiles_begin() on (off by default):
+ * first writing only depth, then only colour where each triangle is at the
+ * depth left. Every pixel is shaded about once, at the cost of rasterizing
+ * every triangle twice.
+ */
+void tiles_set_prepass(bool enabled);
+/*
+ * Start collecting triangles for a render target. If its bins can't be
+ * allocated, nothing is drawn until a later tiles_begin() succeeds.
+ */
+void tiles_begin(const target_t *target);
+/*
+ * Clear the target's color, depth and coarse depth lazily: each tile is
+ * cleared by the thread filling it, just before its first triangle, and
+ * tiles no triangle touches are cleared along with them. Call it before
+ * any triangles are submitted; the target keeps its old contents until
+ * the tiles are filled.
+ */
+void tiles_clear(col_t col);
+/*
+ * Set up a screen space triangle, textured if tex isn't NULL, and bin it.
+ * Out of memory, it is left out of the tiles it has no room in.
+ */
+void tiles_submit(tri_t tri, tri_col_t cols, const tri_tex_t *tex);
+/* Fill every bin in parallel and wait for all tiles to finish */
+void tiles_flush(void);
+/*
+ * Start filling every bin on the workers and return straight away, so the
+ * next frame can be binned meanwhile. The target must not be touched until
+ * tiles_wait(). Without workers this fills the tiles itself, like
+ * tiles_flush().
+ */
+void tiles_kick(void);
+/*
+ * Wait for the tiles started by tiles_kick() to finish, if any. Their
+ * pixel counts go to the profiler's current frame.
+ */
+void tiles_wait(void);
+
+#endif /* TILES_H */
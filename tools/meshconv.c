@@ -0,0 +1,46 @@
+/* C Stdlib Headers */
+#include <stdio.h>  /* Console I/O */
+#include <string.h> /* strcmp() */
+
+/* Project headers */
+#include "mesh.h" /* Mesh loading and saving */
+
+/*
+ * Mesh converter: turns a Wavefront OBJ file into a binary mesh file that
+ * the renderer can map and draw without parsing.
+ */
+
+/* Print command line usage */
+static void usage(const char *prog) {
+  printf(
+      "Usage: %s INPUT OUTPUT\n"
+      "  Convert INPUT (OBJ or binary mesh) to a binary mesh file OUTPUT\n",
+      prog
+  );
+}
+
+/* Entry point */
+int main(int argc, char **argv) {
+  if (argc == 2 && strcmp(argv[1], "--help") == 0) {
+    usage(argv[0]);
+    return 0;
+  }
+  if (argc != 3) {
+    usage(argv[0]);
+    return 1;
+  }
+  mesh_t mesh;
+  if (!mesh_load(argv[1], &mesh)) {
+    fprintf(stderr, "ERROR: Failed to load mesh '%s'\n", argv[1]);
+    return 1;
+  }
+  bool ok = mesh_save(argv[2], &mesh);
+  if (ok) {
+    printf("INFO: Wrote '%s' (%u vertices, %u triangles)\n",
+           argv[2], mesh.vert_count, mesh.tri_count);
+  } else {
+    fprintf(stderr, "ERROR: Failed to write '%s'\n", argv[2]);
+  }
+  mesh_free(&mesh);
+  return ok ? 0 : 1;
+}